@@ -0,0 +1,2910 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// GitBSLR is available under the same license as Git itself. If Git relicenses, you may choose
+//    whether to use GitBSLR under GPLv2 or Git's new license.
+
+// Terminology:
+// Git - obvious
+// GitBSLR - this tool
+// Work tree - where your repo is checked out
+// Git directory - .git, usually in work tree
+// Real path - a path as seen by the kernel
+// Virtual path - a path as seen by Git (always relative to work tree)
+
+#ifndef GITBSLR_H
+#define GITBSLR_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef BUG_URL
+#define BUG_URL "https://github.com/Alcaro/GitBSLR/issues"
+#endif
+
+#if defined(__linux__)
+# define HAVE_STAT64 1
+#else
+# define HAVE_STAT64 0
+# warning "Untested platform, please report whether it works: https://github.com/Alcaro/GitBSLR/issues"
+#endif
+
+#ifdef _STAT_VER
+# define HAVE_STAT_VER 1
+#else
+# define HAVE_STAT_VER 0
+#endif
+
+#undef DEBUG
+#define DEBUG(...) do { if (debug_level >= 1) fprintf(stderr, __VA_ARGS__); } while(0)
+#define DEBUG_VERBOSE(...) do { if (debug_level >= 2) fprintf(stderr, __VA_ARGS__); } while(0)
+#define FATAL(...) do { fprintf(stderr, __VA_ARGS__); exit(1); } while(0)
+// DEBUG and DEBUG_VERBOSE use whatever debug_level is in scope; in path_handler, that's the member.
+
+// libgitbslr.a is linked into other programs, which may have their own string class, or anything else with the same name.
+namespace gitbslr_internal {
+
+
+class anyptr {
+	void* data;
+public:
+	template<typename T> anyptr(T* data_) { data = (void*)data_; }
+	template<typename T> operator T*() { return (T*)data; }
+	template<typename T> operator const T*() const { return (const T*)data; }
+};
+
+template<typename T> static T min(const T& a, const T& b) { return a < b ? a : b; }
+template<typename T> static T max(const T& a, const T& b) { return a > b ? a : b; }
+
+#define DLLEXPORT extern "C" __attribute__((__visibility__("default")))
+
+static void malloc_fail()
+{
+	FATAL("GitBSLR: out of memory\n");
+}
+
+static anyptr malloc_check(size_t size)
+{
+	void* ret = malloc(size);
+	if (size && !ret) malloc_fail();
+	return ret;
+}
+
+static anyptr realloc_check(anyptr ptr, size_t size)
+{
+	void* ret = realloc(ptr, size);
+	if (size && !ret) malloc_fail();
+	return ret;
+}
+
+#define malloc malloc_check
+#define realloc realloc_check
+
+#ifndef __GLIBC__
+static const char * strchrnul(const char * s, int c)
+{
+	const char * ret = strchr(s, c);
+	return ret ? ret : s+strlen(s);
+}
+
+static void * memrchr(const void * s, int c, size_t n)
+{
+	const uint8_t * s8 = (uint8_t*)s;
+	while (--n)
+	{
+		if (s8[n] == c)
+			return (void*)(s8+n);
+	}
+	return NULL;
+}
+
+static char* my_getcwd(char* buf, size_t size)
+{
+	if (buf) return getcwd(buf, size);
+	
+	size_t buflen = 64;
+	char* buf = malloc(buflen);
+	
+	while (!getcwd(buf, buflen))
+	{
+		buflen *= 2;
+		buf = realloc(buf, buflen);
+	}
+	
+	buf[r] = '\0';
+	return buf;
+}
+#define getcwd my_getcwd
+#endif
+
+class string {
+	char* ptr;
+	size_t len;
+	
+	void set(const char * other, size_t len)
+	{
+		if (!len)
+		{
+			this->ptr = NULL;
+			this->len = 0;
+			return;
+		}
+		
+		this->ptr = malloc(len+1);
+		this->len = len;
+		memcpy(ptr, other, len);
+		ptr[len] = '\0';
+	}
+	void set(const char * other) { set(other, other ? strlen(other) : 0); } // NULL is the same as blank
+	
+public:
+	string() { ptr = NULL; len = 0; }
+	string(const string& other) { set(other.ptr, other.len); }
+	string(const char * other) { set(other); }
+	string(const char * other, size_t len) { set(other, len); }
+	~string() { free(ptr); }
+	
+	operator const char *() const { return ptr ? ptr : ""; }
+	const char * c_str() const { return ptr ? ptr : ""; }
+	size_t length() const { return len; }
+	operator bool() const { return len; }
+	bool operator!() const { return len==0; }
+	
+	string& operator=(const char * other)
+	{
+		free(ptr);
+		set(other);
+		return *this;
+	}
+	string& operator=(const string& other)
+	{
+		free(ptr);
+		set(other.ptr, other.len);
+		return *this;
+	}
+	
+	string& operator+=(const string& other)
+	{
+		if (!other.len) return *this;
+		ptr = realloc(ptr, len+other.len+1);
+		strcpy(ptr+len, other.ptr);
+		len += other.len;
+		return *this;
+	}
+	
+	string operator+(const string& other) const
+	{
+		string ret = *this;
+		ret += other;
+		return ret;
+	}
+	
+	string operator+(const char * other) const
+	{
+		string ret = *this;
+		ret += other;
+		return ret;
+	}
+	
+	bool operator==(const char * other) const
+	{
+		if (ptr) return !strcmp(ptr, other);
+		else return (!other || !*other);
+	}
+	
+	bool operator!=(const char * other) const
+	{
+		return !operator==(other);
+	}
+	
+	static string create_usurp(char * str)
+	{
+		string ret;
+		ret.ptr = str;
+		ret.len = str ? strlen(str) : 0;
+		return ret;
+	}
+	
+	bool contains(const char * other) const
+	{
+		if (ptr) return strstr(ptr, other);
+		else return (!other || !*other);
+	}
+	bool startswith(const char * other) const
+	{
+		if (ptr) return !memcmp(ptr, other, strlen(other));
+		else return (!other || !*other);
+	}
+	bool endswith(const char * other) const
+	{
+		if (ptr) return !memcmp(ptr+len-strlen(other), other, strlen(other));
+		else return (!other || !*other);
+	}
+	
+	// FNV-1a
+	uint32_t hash() const
+	{
+		uint32_t ret = 2166136261u;
+		for (size_t i=0;i<len;i++)
+			ret = (ret ^ (uint8_t)ptr[i]) * 16777619u;
+		return ret;
+	}
+};
+
+// Hash map from strings to anything default constructible and copyable.
+template<typename T> class strmap {
+	struct node {
+		string key;
+		T value;
+		node* next;
+	};
+	node** buckets;
+	size_t n_buckets; // always a power of two
+	size_t n_items;
+	
+	void grow()
+	{
+		size_t new_n_buckets = n_buckets*2;
+		node** new_buckets = (node**)calloc(new_n_buckets, sizeof(node*));
+		if (!new_buckets) malloc_fail();
+		for (size_t i=0;i<n_buckets;i++)
+		{
+			node* n = buckets[i];
+			while (n)
+			{
+				node* next = n->next;
+				size_t bucket = n->key.hash() & (new_n_buckets-1);
+				n->next = new_buckets[bucket];
+				new_buckets[bucket] = n;
+				n = next;
+			}
+		}
+		free(buckets);
+		buckets = new_buckets;
+		n_buckets = new_n_buckets;
+	}
+	
+	strmap(const strmap&); // not implemented
+	strmap& operator=(const strmap&);
+	
+public:
+	strmap()
+	{
+		n_buckets = 16;
+		n_items = 0;
+		buckets = (node**)calloc(n_buckets, sizeof(node*));
+		if (!buckets) malloc_fail();
+	}
+	~strmap()
+	{
+		reset();
+		free(buckets);
+	}
+	
+	size_t size() const { return n_items; }
+	
+	// Returns NULL if the key doesn't exist.
+	T* get(const string& key) const
+	{
+		for (node* n = buckets[key.hash() & (n_buckets-1)]; n; n = n->next)
+		{
+			if (n->key.length() == key.length() && n->key == key)
+				return &n->value;
+		}
+		return NULL;
+	}
+	
+	// Inserts a default constructed value if the key doesn't exist.
+	T& operator[](const string& key)
+	{
+		T* ret = get(key);
+		if (ret) return *ret;
+		
+		if (n_items >= n_buckets) grow();
+		size_t bucket = key.hash() & (n_buckets-1);
+		node* n = new node();
+		n->key = key;
+		n->next = buckets[bucket];
+		buckets[bucket] = n;
+		n_items++;
+		return n->value;
+	}
+	
+	void reset()
+	{
+		for (size_t i=0;i<n_buckets;i++)
+		{
+			node* n = buckets[i];
+			while (n)
+			{
+				node* next = n->next;
+				delete n;
+				n = next;
+			}
+			buckets[i] = NULL;
+		}
+		n_items = 0;
+	}
+	
+	// Returns whether it was there.
+	bool remove(const string& key)
+	{
+		node** link = &buckets[key.hash() & (n_buckets-1)];
+		while (*link)
+		{
+			node* n = *link;
+			if (n->key.length() == key.length() && n->key == key)
+			{
+				*link = n->next;
+				delete n;
+				n_items--;
+				return true;
+			}
+			link = &n->next;
+		}
+		return false;
+	}
+	
+	// Removes every item for which pred(key, value) returns true. pred may free anything the value owns.
+	template<typename P> void remove_if(const P& pred)
+	{
+		for (size_t i=0;i<n_buckets;i++)
+		{
+			node** link = &buckets[i];
+			while (*link)
+			{
+				node* n = *link;
+				if (pred(n->key, n->value))
+				{
+					*link = n->next;
+					delete n;
+					n_items--;
+				}
+				else link = &n->next;
+			}
+		}
+	}
+	
+	// Iteration order is unspecified. Don't insert while iterating.
+	class iterator {
+		friend class strmap;
+		const strmap* map;
+		size_t bucket;
+		node* n;
+		
+		void settle()
+		{
+			while (!n && ++bucket < map->n_buckets)
+				n = map->buckets[bucket];
+		}
+	public:
+		operator bool() const { return n; }
+		const string& key() const { return n->key; }
+		T& value() const { return n->value; }
+		void operator++() { n = n->next; settle(); }
+	};
+	iterator begin() const
+	{
+		iterator ret;
+		ret.map = this;
+		ret.bucket = 0;
+		ret.n = buckets[0];
+		ret.settle();
+		return ret;
+	}
+};
+
+
+
+typedef int (*lstat_t)(const char * path, struct stat* buf);
+typedef ssize_t (*readlink_t)(const char * path, char * buf, size_t bufsiz);
+typedef struct dirent* (*readdir_t)(DIR* dirp);
+typedef int (*symlink_t)(const char * target, const char * linkpath);
+typedef int (*unlink_t)(const char * path);
+typedef int (*rmdir_t)(const char * path);
+typedef int (*rename_t)(const char * oldpath, const char * newpath);
+typedef int (*chdir_t)(const char * path);
+typedef int (*fchdir_t)(int fd);
+typedef int (*execve_t)(const char * path, char * const argv[], char * const envp[]);
+typedef pid_t (*waitpid_t)(pid_t pid, int * wstatus, int options);
+
+static lstat_t lstat_o;
+static readlink_t readlink_o;
+static readdir_t readdir_o;
+static symlink_t symlink_o;
+static unlink_t unlink_o;
+static rmdir_t rmdir_o;
+static rename_t rename_o;
+static chdir_t chdir_o;
+static fchdir_t fchdir_o;
+static execve_t execve_o;
+static waitpid_t waitpid_o;
+
+#if HAVE_STAT_VER
+typedef int (*__lxstat_t)(int ver, const char * path, struct stat* buf);
+static __lxstat_t __lxstat_o;
+#endif
+
+#if HAVE_STAT64
+typedef struct dirent64* (*readdir64_t)(DIR* dirp);
+static readdir64_t readdir64_o;
+typedef int (*lstat64_t)(const char * path, struct stat64* buf);
+static lstat64_t lstat64_o;
+#endif
+
+#if HAVE_STAT64 && HAVE_STAT_VER
+typedef int (*__lxstat64_t)(int ver, const char * path, struct stat64* buf);
+static __lxstat64_t __lxstat64_o;
+#endif
+
+static inline void ensure_type_correctness()
+{
+	// If any of the above typedefs are incorrect, these will throw various compile errors.
+	// If the functions don't exist at all, it will also throw errors, signaling that some of the HAVE_ checks are wrong.
+	(void)(lstat_o == lstat);
+	(void)(readlink_o == readlink);
+	(void)(readdir_o == readdir);
+	(void)(symlink_o == symlink);
+	(void)(unlink_o == unlink);
+	(void)(rmdir_o == rmdir);
+	(void)(rename_o == rename);
+	(void)(chdir_o == chdir);
+	(void)(fchdir_o == fchdir);
+	(void)(execve_o == execve);
+	(void)(waitpid_o == waitpid);
+#if HAVE_STAT_VER
+	(void)(__lxstat == __lxstat_o);
+#endif
+#if HAVE_STAT64
+	(void)(readdir64 == readdir64_o);
+	(void)(lstat64_o == lstat64);
+#endif
+#if HAVE_STAT64 && HAVE_STAT_VER
+	(void)(__lxstat64 == __lxstat64_o);
+#endif
+}
+
+#if HAVE_STAT_VER
+static int lstat_lxstat_wrap(const char * path, struct stat * buf)
+{
+	return __lxstat_o(_STAT_VER, path, buf);
+}
+#endif
+#if HAVE_STAT64 && HAVE_STAT_VER
+static int lstat64_lxstat_wrap(const char * path, struct stat64 * buf)
+{
+	return __lxstat64_o(_STAT_VER, path, buf);
+}
+#endif
+
+// Finds the real versions of the functions GitBSLR overrides. path_handler's constructor calls this.
+static void load_originals()
+{
+	if (lstat_o) return;
+	
+	lstat_o = (lstat_t)dlsym(RTLD_NEXT, "lstat");
+#if HAVE_STAT_VER
+	if (!lstat_o)
+	{
+		__lxstat_o = (__lxstat_t)dlsym(RTLD_NEXT, "__lxstat");
+		if (__lxstat_o) lstat_o = lstat_lxstat_wrap;
+	}
+#endif
+	readlink_o = (readlink_t)dlsym(RTLD_NEXT, "readlink");
+	readdir_o = (readdir_t)dlsym(RTLD_NEXT, "readdir");
+	symlink_o = (symlink_t)dlsym(RTLD_NEXT, "symlink");
+	unlink_o = (unlink_t)dlsym(RTLD_NEXT, "unlink");
+	rmdir_o = (rmdir_t)dlsym(RTLD_NEXT, "rmdir");
+	rename_o = (rename_t)dlsym(RTLD_NEXT, "rename");
+	chdir_o = (chdir_t)dlsym(RTLD_NEXT, "chdir");
+	fchdir_o = (fchdir_t)dlsym(RTLD_NEXT, "fchdir");
+	execve_o = (execve_t)dlsym(RTLD_NEXT, "execve");
+	waitpid_o = (waitpid_t)dlsym(RTLD_NEXT, "waitpid");
+	
+#if HAVE_STAT64
+	readdir64_o = (readdir64_t)dlsym(RTLD_NEXT, "readdir64");
+	lstat64_o = (lstat64_t)dlsym(RTLD_NEXT, "lstat64");
+#if HAVE_STAT_VER
+	if (!lstat64_o)
+	{
+		__lxstat64_o = (__lxstat64_t)dlsym(RTLD_NEXT, "__lxstat64");
+		if (__lxstat64_o) lstat64_o = lstat64_lxstat_wrap;
+	}
+#endif
+#endif
+	
+	if (!lstat_o || !readlink_o || !readdir_o || !symlink_o || !unlink_o || !rmdir_o || !rename_o || !chdir_o || !fchdir_o || !execve_o || !waitpid_o
+#if HAVE_STAT64
+		|| !readdir64_o || !lstat64_o
+#endif
+		)
+		FATAL("GitBSLR: couldn't dlsym required symbols (this is a GitBSLR bug, please report it: " BUG_URL ")\n");
+}
+
+
+// How many times GitBSLR called the underlying filesystem functions, for GITBSLR_STATS.
+// Includes calls passed through on Git's behalf; 'interposed' is how many calls Git made to GitBSLR.
+struct call_stats {
+	unsigned long interposed;
+	unsigned long prefetch; // how many of the filesystem calls the prefetch thread made
+	unsigned long readlink;
+	unsigned long lstat;
+	unsigned long stat;
+	unsigned long realpath;
+	unsigned long getcwd;
+	
+	call_stats() : interposed(0), prefetch(0), readlink(0), lstat(0), stat(0), realpath(0), getcwd(0) {}
+	unsigned long total() const { return readlink + lstat + stat + realpath + getcwd; }
+	
+	// one line per process, so a test can add up everything a Git command and its children did
+	void print(FILE* f) const
+	{
+		fprintf(f, "GitBSLR stats: pid=%d interposed=%lu prefetch=%lu readlink=%lu lstat=%lu stat=%lu realpath=%lu getcwd=%lu\n",
+		        (int)getpid(), interposed, prefetch, readlink, lstat, stat, realpath, getcwd);
+	}
+};
+// atomic, gitbslr-resolve calls these from several threads
+// Only call them if the counts are wanted; every thread writing the same cache line on every call isn't free.
+static inline void count_call(unsigned long& n) { __sync_fetch_and_add(&n, 1); }
+static inline void count_calls(unsigned long& n, unsigned long count) { __sync_fetch_and_add(&n, count); }
+// The same filesystem calls, but only the current thread's, so the profiler can tell which resolution made them.
+static __thread unsigned long thread_fs_calls;
+// In libgitbslr, set if a resolution failed; the call that asked for it should fail with this errno. Otherwise zero.
+static __thread int resolve_errno;
+
+static uint64_t time_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// GITBSLR_PROFILE - charges the cost of every resolution to the work tree directory containing the path,
+//  and counts which links and GITBSLR_FOLLOW rules were involved. Written out on exit.
+// Git resolves from several threads if the index is big (core.preloadindex), so the cost of a resolution is the wall
+//  time and filesystem calls of the thread doing it, and the tables are locked. Wall time, since on NFS and other slow
+//  filesystems, most of it is spent waiting.
+class profiler {
+public:
+	struct cost {
+		unsigned long calls;
+		unsigned long fs_calls;
+		uint64_t ns;
+		cost() : calls(0), fs_calls(0), ns(0) {}
+	};
+	
+	// Stick one of these on the stack when entering an interposed function. Does nothing if profiling is disabled.
+	struct timer {
+		uint64_t start_ns;
+		unsigned long start_fs_calls;
+		timer(const profiler* p)
+		{
+			if (!p) return;
+			start_ns = time_ns();
+			start_fs_calls = thread_fs_calls;
+		}
+	};
+	
+private:
+	pthread_mutex_t lock;
+	
+public:
+	profiler() { pthread_mutex_init(&lock, NULL); }
+	~profiler() { pthread_mutex_destroy(&lock); }
+	
+	static const int top_n = 20;
+	
+	strmap<cost> dirs; // key is the virtual directory, with trailing slash, or blank for the work tree root
+	strmap<unsigned long> links; // key is the virtual path of the link
+	strmap<unsigned long> rules; // key is the rule, as written in GITBSLR_FOLLOW
+	
+	// Input path is virtual, relative to work tree.
+	void charge(const string& path, const timer& t)
+	{
+		const char * start = path;
+		const char * slash = strrchr(start, '/');
+		if (slash && !slash[1]) // ignore a trailing slash
+			slash = (const char*)memrchr(start, '/', slash-start);
+		string dir = (slash ? string(start, slash+1-start) : string());
+		unsigned long fs_calls = thread_fs_calls - t.start_fs_calls;
+		uint64_t ns = time_ns() - t.start_ns;
+		
+		pthread_mutex_lock(&lock);
+		cost& c = dirs[dir];
+		c.calls++;
+		c.fs_calls += fs_calls;
+		c.ns += ns;
+		pthread_mutex_unlock(&lock);
+	}
+	
+	void link(const string& path)
+	{
+		pthread_mutex_lock(&lock);
+		links[path]++;
+		pthread_mutex_unlock(&lock);
+	}
+	void rule(const string& rule)
+	{
+		pthread_mutex_lock(&lock);
+		rules[rule]++;
+		pthread_mutex_unlock(&lock);
+	}
+	
+private:
+	struct entry {
+		const string* key;
+		uint64_t weight;
+	};
+	static int entry_compare(const void* a, const void* b)
+	{
+		const entry* ea = (const entry*)a;
+		const entry* eb = (const entry*)b;
+		if (ea->weight != eb->weight) return ea->weight > eb->weight ? -1 : 1;
+		return strcmp(*ea->key, *eb->key);
+	}
+	template<typename T> static entry* sorted(const strmap<T>& map, uint64_t (*weight)(const T&))
+	{
+		entry* ret = malloc(sizeof(entry) * (map.size()+1));
+		size_t n = 0;
+		for (typename strmap<T>::iterator it = map.begin(); it; ++it)
+		{
+			ret[n].key = &it.key();
+			ret[n].weight = weight(it.value());
+			n++;
+		}
+		qsort(ret, n, sizeof(entry), entry_compare);
+		return ret;
+	}
+	static uint64_t cost_weight(const cost& c) { return c.ns; }
+	static uint64_t count_weight(const unsigned long& n) { return n; }
+	
+public:
+	void report(FILE* f) const
+	{
+		// a subtree costs whatever the directory itself costs, plus all its subdirectories
+		strmap<cost> subtrees;
+		cost total;
+		for (strmap<cost>::iterator it = dirs.begin(); it; ++it)
+		{
+			const string& dir = it.key();
+			const cost& c = it.value();
+			total.calls += c.calls;
+			total.fs_calls += c.fs_calls;
+			total.ns += c.ns;
+			
+			size_t len = dir.length();
+			while (true)
+			{
+				cost& sub = subtrees[string(dir, len)];
+				sub.calls += c.calls;
+				sub.fs_calls += c.fs_calls;
+				sub.ns += c.ns;
+				if (!len) break;
+				len--;
+				while (len && dir[len-1] != '/') len--;
+			}
+		}
+		
+		fprintf(f, "GitBSLR profile: pid=%d, %lu resolutions, %.3fms, %lu filesystem calls\n",
+		        (int)getpid(), total.calls, total.ns/1000000.0, total.fs_calls);
+		
+		entry* e = sorted(subtrees, cost_weight);
+		fprintf(f, "Most expensive subtrees:\n");
+		for (size_t i=0;i<subtrees.size() && i<top_n;i++)
+		{
+			const cost& c = *subtrees.get(*e[i].key);
+			fprintf(f, "  %10.3fms %8lu resolutions %8lu fs calls  %s\n",
+			        c.ns/1000000.0, c.calls, c.fs_calls, *e[i].key ? e[i].key->c_str() : "./");
+		}
+		free(e);
+		
+		e = sorted(links, count_weight);
+		fprintf(f, "Most evaluated links:\n");
+		for (size_t i=0;i<links.size() && i<top_n;i++)
+			fprintf(f, "  %8lu  %s\n", (unsigned long)e[i].weight, e[i].key->c_str());
+		free(e);
+		
+		e = sorted(rules, count_weight);
+		fprintf(f, "Most matched GITBSLR_FOLLOW rules:\n");
+		for (size_t i=0;i<rules.size() && i<top_n;i++)
+			fprintf(f, "  %8lu  %s\n", (unsigned long)e[i].weight, e[i].key->c_str());
+		free(e);
+	}
+};
+
+// GIT_TRACE2_EVENT - GitBSLR adds its own events to Git's trace2 event stream, in the same format, so its cost
+//  shows up next to Git's: a region for every slow resolution and every symlink creation, and a summary every second.
+class trace2 {
+	int fd; // -2 = disabled
+	string target;
+	bool is_dir;
+	const call_stats* stats;
+	uint64_t start_ns;
+	uint64_t last_summary_ns;
+	
+	unsigned long resolutions;
+	unsigned long slow_resolutions;
+	uint64_t resolve_ns;
+	
+	static string json_escape(const char * in)
+	{
+		string ret;
+		char buf[8];
+		for (const char * iter = in; *iter; iter++)
+		{
+			unsigned char c = *iter;
+			if (c == '"' || c == '\\') { buf[0] = '\\'; buf[1] = c; buf[2] = '\0'; }
+			else if (c < 0x20) sprintf(buf, "\\u%04x", c);
+			else { buf[0] = c; buf[1] = '\0'; }
+			ret += buf;
+		}
+		return ret;
+	}
+	
+	// Git sets this to its own session ID once trace2 starts, for its children; it's the best name for this process too.
+	static string sid()
+	{
+		const char * sid = getenv("GIT_TRACE2_PARENT_SID");
+		if (sid && *sid) return json_escape(sid);
+		char buf[64];
+		sprintf(buf, "gitbslr-P%08x", (unsigned)getpid());
+		return buf;
+	}
+	
+	// Wall clock time, ns_ago nanoseconds ago, formatted like trace2 does.
+	static string timestamp(uint64_t ns_ago)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		uint64_t now = (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec - ns_ago;
+		time_t sec = now / 1000000000;
+		struct tm tm;
+		gmtime_r(&sec, &tm);
+		char buf[64];
+		size_t len = strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+		sprintf(buf+len, ".%06luZ", (unsigned long)(now % 1000000000 / 1000));
+		return buf;
+	}
+	
+	// Called from the constructor, before there are any other threads. Git hasn't started its own trace2 yet, so
+	//  the only session ID available is the parent's, if any; the pid keeps siblings apart.
+	void open_target()
+	{
+		if (is_dir)
+		{
+			// like Git, one file per process; child sessions' IDs contain slashes
+			string name = target + "/";
+			const char * id = getenv("GIT_TRACE2_PARENT_SID");
+			for (const char * iter = id; iter && *iter; iter++)
+				name += (*iter == '/' ? "-" : string(iter, 1));
+			char buf[64];
+			sprintf(buf, "%sgitbslr-P%08x", (id && *id ? "-" : ""), (unsigned)getpid());
+			fd = open(name + (const char*)buf, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0666);
+		}
+		else
+			fd = open(target, O_WRONLY|O_APPEND|O_CREAT|O_CLOEXEC, 0666);
+		if (fd < 0) fd = -2;
+	}
+	
+	// Each event is one write, so events from several threads or processes don't get mixed up.
+	void emit(const string& line)
+	{
+		if (fd < 0) return;
+		string full = line + "\n";
+		ssize_t ignored = write(fd, full.c_str(), full.length());
+		(void)ignored;
+	}
+	
+	string header(const char * event, uint64_t ns_ago, int line)
+	{
+		char buf[128];
+		sprintf(buf, "\",\"thread\":\"gitbslr\",\"time\":\"%s\",\"file\":\"gitbslr.h\",\"line\":%d,\"nesting\":1",
+		        timestamp(ns_ago).c_str(), line);
+		return string("{\"event\":\"") + event + "\",\"sid\":\"" + sid() + (const char*)buf;
+	}
+	
+	double t_abs() const { return (time_ns()-start_ns) / 1000000000.0; }
+	
+public:
+	// Resolutions faster than this aren't worth a region.
+	static const uint64_t slow_ns = 1000000;
+	static const uint64_t summary_interval_ns = 1000000000;
+	
+	// target is the value of GIT_TRACE2_EVENT. Sockets aren't supported; if enabled() is false, delete this object.
+	trace2(const char * target, const call_stats* stats) : stats(stats)
+	{
+		start_ns = time_ns();
+		last_summary_ns = start_ns;
+		resolutions = 0;
+		slow_resolutions = 0;
+		resolve_ns = 0;
+		is_dir = false;
+		fd = -2;
+		
+		if (!target || !*target || !strcmp(target, "0") || !strcasecmp(target, "false"))
+			return;
+		if (!strcmp(target, "1") || !strcasecmp(target, "true"))
+			fd = 2;
+		else if (target[0] >= '2' && target[0] <= '9' && !target[1])
+			fd = target[0]-'0';
+		else if (target[0] == '/')
+		{
+			this->target = target;
+			struct stat st;
+			is_dir = (stat(target, &st) == 0 && S_ISDIR(st.st_mode));
+			open_target();
+		}
+	}
+	~trace2()
+	{
+		uint64_t now = time_ns();
+		summary(now - __sync_lock_test_and_set(&last_summary_ns, now));
+		if (fd > 2 && target) close(fd);
+	}
+	bool enabled() const { return fd != -2; }
+	
+	// A finished region; the enter event is written afterwards, with the right time, since most resolutions aren't
+	// worth writing at all. start is from time_ns.
+	void region(const char * label, const string& msg, uint64_t start)
+	{
+		uint64_t ns = time_ns()-start;
+		double abs = t_abs();
+		emit(header("region_enter", ns, __LINE__) + ",\"category\":\"gitbslr\",\"label\":\"" + label + "\",\"msg\":\"" +
+		     json_escape(msg) + "\"}");
+		char buf[128];
+		sprintf(buf, ",\"t_abs\":%.6f,\"t_rel\":%.6f,\"category\":\"gitbslr\",\"label\":\"", abs, ns/1000000000.0);
+		emit(header("region_leave", 0, __LINE__) + (const char*)buf + label + "\"}");
+	}
+	
+	// Counts a resolution, and writes a summary if it's time for that. Returns whether it's slow enough for a region.
+	bool resolved(uint64_t start)
+	{
+		uint64_t now = time_ns();
+		uint64_t ns = now-start;
+		__sync_fetch_and_add(&resolutions, 1);
+		__sync_fetch_and_add(&resolve_ns, ns);
+		// only the thread that moves last_summary_ns forward writes the summary
+		uint64_t last = last_summary_ns;
+		if (now - last >= summary_interval_ns && __sync_bool_compare_and_swap(&last_summary_ns, last, now))
+			summary(now - last);
+		if (ns < slow_ns) return false;
+		__sync_fetch_and_add(&slow_resolutions, 1);
+		return true;
+	}
+	
+	// rel_ns is the time since the previous summary.
+	void summary(uint64_t rel_ns)
+	{
+		double rel = rel_ns / 1000000000.0;
+		if (!resolutions) return;
+		char buf[512];
+		sprintf(buf, ",\"t_abs\":%.6f,\"t_rel\":%.6f,\"category\":\"gitbslr\",\"key\":\"summary\",\"value\":"
+		             "{\"resolutions\":%lu,\"slow_resolutions\":%lu,\"resolve_ms\":%.3f,\"fs_calls\":%lu,\"interposed\":%lu}}",
+		        t_abs(), rel, resolutions, slow_resolutions, resolve_ns/1000000.0, stats->total(), stats->interposed);
+		emit(header("data_json", 0, __LINE__) + (const char*)buf);
+	}
+};
+
+static string dirname_d(const string& path)
+{
+	if (path.endswith("/"))
+	{
+		return dirname_d(string(path, path.length()-1));
+	}
+	const char * start = path;
+	const char * last = strrchr(start, '/');
+	return string(start, last-start+1);
+}
+
+// Everything path_handler needs to know. path_handler itself never looks at the environment;
+// gitbslr.so and gitbslr-resolve use from_env, other users can fill it in however they want.
+struct gitbslr_config {
+	// Absolute paths. Blank means autodetect, from the first access to a .git directory.
+	string work_tree;
+	string git_dir;
+	// Same syntax as GITBSLR_FOLLOW.
+	string follow;
+	// Used to find ~/.gitconfig and $XDG_CONFIG_HOME/git/config, which Git is allowed to access. Blank if not set.
+	string home;
+	string xdg_config_home;
+	
+	int debug_level;
+	bool verify;
+	bool profile;
+	bool prefetch;
+	// GITBSLR_STATS is set; if not, the call counts aren't needed, unless for trace2.
+	bool stats;
+	// GITBSLR_ATTR_TTL, in milliseconds; 0 if disabled.
+	unsigned long attr_ttl_ms;
+	// GIT_TRACE2_EVENT, if GitBSLR should add to it. Blank if not.
+	string trace2;
+	
+	// If false, relative paths are relative to the current directory, which should be the work tree root, like for Git.
+	// If true, they're relative to the work tree, and the current directory is never looked at.
+	bool relative_to_work_tree;
+	// If true, errors that would otherwise exit the process fail the current call instead, with errno set.
+	// For libgitbslr, which must not exit the program it's part of.
+	bool library;
+	
+	gitbslr_config() : debug_level(0), verify(false), profile(false), prefetch(false), stats(false), attr_ttl_ms(0),
+	                   relative_to_work_tree(false), library(false) {}
+	
+	static gitbslr_config from_env()
+	{
+		gitbslr_config ret;
+		
+		const char * debug = getenv("GITBSLR_DEBUG");
+		if (debug)
+		{
+			char * end;
+			ret.debug_level = strtol(debug, &end, 0);
+			if (*end) ret.debug_level = 1;
+		}
+		
+		const char * verify = getenv("GITBSLR_VERIFY");
+		ret.verify = (verify && *verify && strcmp(verify, "0") != 0);
+		const char * profile = getenv("GITBSLR_PROFILE");
+		ret.profile = (profile && *profile);
+		const char * prefetch = getenv("GITBSLR_PREFETCH");
+		ret.prefetch = (prefetch && *prefetch && strcmp(prefetch, "0") != 0);
+		const char * stats = getenv("GITBSLR_STATS");
+		ret.stats = (stats && *stats);
+		const char * attr_ttl = getenv("GITBSLR_ATTR_TTL");
+		if (attr_ttl && *attr_ttl)
+		{
+			char * end;
+			ret.attr_ttl_ms = strtoul(attr_ttl, &end, 10);
+			if (*end) FATAL("GitBSLR: GITBSLR_ATTR_TTL must be a number of milliseconds, not %s\n", attr_ttl);
+		}
+		
+		ret.work_tree = getenv("GITBSLR_WORK_TREE");
+		ret.git_dir = getenv("GITBSLR_GIT_DIR");
+		ret.follow = getenv("GITBSLR_FOLLOW");
+		ret.home = getenv("HOME");
+		ret.xdg_config_home = getenv("XDG_CONFIG_HOME");
+		return ret;
+	}
+	
+	// For standalone tools. Makes the work tree and Git directory absolute realpaths, and if the Git directory
+	// isn't set, looks for a .git in the work tree, or the current directory, and their parents.
+	void find_repo()
+	{
+		if (work_tree)
+			work_tree = realpath_or_die(work_tree);
+		if (git_dir)
+		{
+			git_dir = realpath_or_die(git_dir);
+			return;
+		}
+		
+		string dir = (work_tree ? work_tree : realpath_or_die("."));
+		while (true)
+		{
+			string candidate = (dir.endswith("/") ? dir : dir+"/") + ".git";
+			struct stat st;
+			if (stat(candidate, &st) == 0 && S_ISDIR(st.st_mode))
+			{
+				git_dir = candidate;
+				return;
+			}
+			if (dir == "/")
+				FATAL("GitBSLR: not in a Git repository; if the Git directory isn't called .git, use GITBSLR_GIT_DIR\n");
+			const char * start = dir;
+			const char * slash = strrchr(start, '/');
+			dir = (slash == start ? string("/") : string(start, slash-start));
+		}
+	}
+	
+private:
+	static string realpath_or_die(const string& path)
+	{
+		string ret = string::create_usurp(realpath(path, NULL));
+		if (!ret)
+			FATAL("GitBSLR: can't access %s: %s\n", path.c_str(), strerror(errno));
+		return ret;
+	}
+};
+
+// What a directory or link in the work tree looks like to Git. Links Git sees as links are vd_link or vd_loop.
+enum verdict_t {
+	vd_unknown, // only the real path is known; resolve_symlink hasn't been asked about this one itself
+	vd_dir, // a real directory
+	vd_inline, // a link that Git sees as the directory or file it points to; usually points outside the work tree
+	vd_link, // a link to somewhere else in the work tree
+	vd_loop, // a link to one of its own parent directories, or something that is the same as one
+};
+
+// The verdict tree; one node per directory or link resolve_symlink has seen, children keyed by name.
+// Nodes are only created for things that exist; a new file can't make anything already known wrong,
+// but anything that removes or renames something must invalidate everything under it, or pointing into it.
+struct verdict_node {
+	// Realpath of the node's virtual path. For links, that's where it points.
+	string canon;
+	// Identity of canon, to find it in the real directory table.
+	dev_t dev;
+	ino_t ino;
+	bool is_link;
+	verdict_t verdict;
+	// What Git sees the link pointing to; blank unless the verdict is vd_link or vd_loop.
+	string target;
+	strmap<verdict_node*> children;
+	
+	verdict_node() : dev(0), ino(0), is_link(false), verdict(vd_unknown) {}
+	~verdict_node()
+	{
+		for (strmap<verdict_node*>::iterator it = children.begin(); it; ++it)
+			delete it.value();
+	}
+};
+
+// The real side of the verdict tree. If several links point to the same directory, all their verdict nodes
+// find it here, keyed by its (st_dev, st_ino), so the filesystem calls to look at its contents are only done once.
+// Only the verdicts themselves, which depend on the virtual path, are separate for each alias.
+struct real_entry {
+	bool is_link;
+	bool is_dir; // for links, whether the target is a directory
+	// For links, these are the target's.
+	dev_t dev;
+	ino_t ino;
+	// Blank unless it's a link.
+	string canon;
+	string link_target;
+	
+	real_entry() : is_link(false), is_dir(false), dev(0), ino(0) {}
+};
+struct real_dir {
+	// The realpath this directory was first seen as. Another realpath for the same inode (bind mounts, for example)
+	// doesn't use this entry; a link's realpath depends on which path the link was found via.
+	string canon;
+	strmap<real_entry> entries; // key is the name
+	// Whether any entry is, or was, a link; if not, invalidating something elsewhere doesn't need to look at the entries.
+	bool has_links;
+	
+	real_dir() : has_links(false) {}
+};
+// GITBSLR_ATTR_TTL's stat results. Git asks for both sizes in some builds; they're cached separately.
+struct attr_entry {
+	uint64_t time; // from time_ns; 0 if not cached
+	struct stat st;
+#if HAVE_STAT64
+	uint64_t time64;
+	struct stat64 st64;
+#endif
+	
+	attr_entry() : time(0)
+#if HAVE_STAT64
+	               , time64(0)
+#endif
+	{}
+	uint64_t& time_of(struct stat*) { return time; }
+	struct stat* data(struct stat*) { return &st; }
+#if HAVE_STAT64
+	uint64_t& time_of(struct stat64*) { return time64; }
+	struct stat64* data(struct stat64*) { return &st64; }
+#endif
+};
+// A snapshot of the verdict tree and real directory table, for passing to a child process. Native byte order and
+// sizes; only the same GitBSLR build is expected to read it.
+struct cache_writer {
+	uint8_t* data;
+	size_t len;
+	size_t cap;
+	
+	cache_writer() : data(NULL), len(0), cap(0) {}
+	~cache_writer() { free(data); }
+	
+	void put(const void* ptr, size_t n)
+	{
+		if (len+n > cap)
+		{
+			cap = max(cap*2, len+n+4096);
+			data = realloc(data, cap);
+		}
+		memcpy(data+len, ptr, n);
+		len += n;
+	}
+	void put_u64(uint64_t n) { put(&n, sizeof(n)); }
+	void put_str(const string& s) { put_u64(s.length()); put(s.c_str(), s.length()); }
+};
+// If the data is truncated or otherwise wrong, everything returns zero or blank, and ok is false.
+struct cache_reader {
+	const uint8_t* data;
+	size_t len;
+	size_t pos;
+	bool ok;
+	
+	cache_reader(const uint8_t* data, size_t len) : data(data), len(len), pos(0), ok(true) {}
+	
+	bool get(void* out, size_t n)
+	{
+		if (!ok || n > len-pos) { ok = false; memset(out, 0, n); return false; }
+		memcpy(out, data+pos, n);
+		pos += n;
+		return true;
+	}
+	uint64_t get_u64() { uint64_t n; get(&n, sizeof(n)); return n; }
+	string get_str()
+	{
+		uint64_t n = get_u64();
+		if (!ok || n > len-pos) { ok = false; return ""; }
+		string ret((const char*)data+pos, n);
+		pos += n;
+		return ret;
+	}
+};
+
+enum path_class_t {
+	cls_git_dir, // or in /usr/share/git-core/
+	cls_work_tree, // not necessarily actually in the work tree, could be hopping through a symlink to outside
+	cls_unknown, // if fatal_unknown is true, this can't be returned; if it would be this, the program terminates instead
+};
+// The context object; everything GitBSLR knows about a repository is in here.
+// It can be used from several threads at once.
+class path_handler {
+public:
+	// These two always end with slash, if configured.
+	string work_tree;
+	string git_dir;
+	
+	// These are filenames, not paths.
+	string git_config_path_1; // ~/.gitconfig
+	string git_config_path_2; // $XDG_CONFIG_HOME/git/config
+	
+	int debug_level;
+	// If set, every resolution is also done by the reference algorithm, and any difference is fatal.
+	bool verify;
+	// GITBSLR_FOLLOW; blank if there are no rules.
+	string follow;
+	// GITBSLR_PROFILE; NULL if disabled.
+	profiler* profile;
+	// GITBSLR_PREFETCH; if set, a thread resolves everything in the index once the Git directory is known.
+	bool prefetch;
+	// GIT_TRACE2_EVENT; NULL if disabled.
+	trace2* trace;
+	// GITBSLR_ATTR_TTL, in nanoseconds; 0 if disabled.
+	uint64_t attr_ttl;
+	
+	mutable call_stats stats;
+	// If false, nothing is counted in stats.
+	bool count_stats;
+	
+private:
+	// The verdict tree's root is the base directory. Blank until the first resolution.
+	mutable verdict_node* tree;
+	// Incremented by flush, so a resolution that started before the flush doesn't put stale data in the new tree.
+	mutable unsigned tree_gen;
+	mutable pthread_mutex_t tree_lock;
+	// Key is inode_key. Flushed along with the tree, protected by the same lock.
+	mutable strmap<real_dir*> real_dirs;
+	// GITBSLR_ATTR_TTL's cache; key is the path, as passed to stat. Only paths outside the work tree are here.
+	// Flushed along with the tree, and protected by the same lock.
+	mutable strmap<attr_entry> attrs;
+	// Signaled by flush, so the prefetch thread can tell when the current directory may have changed.
+	mutable pthread_cond_t flushed;
+	// Inherited from the parent process, but not yet known to be relative to the right directory.
+	mutable verdict_node* inherited_tree;
+	// Also inherited, but not yet loaded, since the Git directory isn't known yet. Owned by this object.
+	uint8_t* pending_cache;
+	size_t pending_cache_len;
+	
+	pthread_t prefetch_thread;
+	bool prefetch_running;
+	volatile bool prefetch_stop;
+	
+	bool relative_to_work_tree;
+	bool library;
+	// What relative paths are relative to; blank for the current directory, otherwise the work tree, with slash.
+	string base;
+	
+	path_handler(const path_handler&); // not implemented
+	path_handler& operator=(const path_handler&);
+	
+public:
+	path_handler(const gitbslr_config& config)
+	{
+		load_originals();
+		
+		tree = NULL;
+		inherited_tree = NULL;
+		pending_cache = NULL;
+		pending_cache_len = 0;
+		tree_gen = 0;
+		pthread_mutex_init(&tree_lock, NULL);
+		pthread_cond_init(&flushed, NULL);
+		prefetch_running = false;
+		prefetch_stop = false;
+		
+		debug_level = config.debug_level;
+		verify = config.verify;
+		follow = config.follow;
+		prefetch = config.prefetch;
+		attr_ttl = (uint64_t)config.attr_ttl_ms * 1000000;
+		profile = config.profile ? new profiler() : NULL;
+		trace = config.trace2 ? new trace2(config.trace2, &stats) : NULL;
+		if (trace && !trace->enabled())
+		{
+			DEBUG("GitBSLR: GIT_TRACE2_EVENT=%s is not supported, not tracing\n", config.trace2.c_str());
+			delete trace;
+			trace = NULL;
+		}
+		count_stats = (config.stats || trace);
+		select_hot_path();
+		relative_to_work_tree = config.relative_to_work_tree;
+		library = config.library;
+		const char * follow_err = follow_error(follow);
+		if (follow_err)
+			FATAL("GitBSLR: %s\n", follow_err);
+		
+		if (config.home)
+			git_config_path_1 = normalize_path(config.home + "/.gitconfig");
+		if (config.xdg_config_home)
+			git_config_path_2 = normalize_path(config.xdg_config_home + "/git/config");
+		
+		if (config.work_tree)
+		{
+			set_work_tree(config.work_tree);
+			DEBUG("GitBSLR: Using work tree %s (configured)\n", work_tree.c_str());
+		}
+		if (config.git_dir)
+		{
+			set_git_dir(config.git_dir);
+			DEBUG("GitBSLR: Using git dir %s (configured)\n", git_dir.c_str());
+		}
+	}
+	
+	~path_handler()
+	{
+		stop_prefetch();
+		flush();
+		free(pending_cache);
+		pthread_cond_destroy(&flushed);
+		pthread_mutex_destroy(&tree_lock);
+		delete profile;
+		delete trace;
+	}
+	
+	void count_fs_call(unsigned long& n) const
+	{
+		if (count_stats) count_call(n);
+		thread_fs_calls++;
+	}
+	
+	// The underlying filesystem functions, counted in stats. Relative paths are relative to the current directory.
+	string readlink_d(const string& path) const
+	{
+		size_t buflen = 64;
+		char* buf = malloc(buflen);
+		
+	again: ;
+		count_fs_call(stats.readlink);
+		ssize_t r = readlink_o(path.c_str(), buf, buflen);
+		if (r <= 0) { free(buf); return ""; }
+		if ((size_t)r >= buflen-1)
+		{
+			buflen *= 2;
+			buf = realloc(buf, buflen);
+			goto again;
+		}
+		
+		buf[r] = '\0';
+		return string::create_usurp(buf);
+	}
+	
+	string realpath_d(const string& path) const
+	{
+		count_fs_call(stats.realpath);
+		return string::create_usurp(realpath(path.c_str(), NULL));
+	}
+	
+	string getcwd_d() const
+	{
+		count_fs_call(stats.getcwd);
+		return string::create_usurp(getcwd(NULL, 0));
+	}
+	
+	int stat_3264(const char * path, struct stat* buf) const
+	{
+		count_fs_call(stats.stat);
+		return stat(path, buf);
+	}
+	int lstat_o_3264(const char * path, struct stat* buf) const
+	{
+		count_fs_call(stats.lstat);
+		return lstat_o(path, buf);
+	}
+#if HAVE_STAT64
+	int stat_3264(const char * path, struct stat64* buf) const
+	{
+		count_fs_call(stats.stat);
+		return stat64(path, buf);
+	}
+	int lstat_o_3264(const char * path, struct stat64* buf) const
+	{
+		count_fs_call(stats.lstat);
+		return lstat64_o(path, buf);
+	}
+#endif
+	
+	// Turns a path relative to the base directory into something the functions above understand.
+	string in_base(const string& path) const
+	{
+		if (!base || path[0] == '/') return path;
+		return base + path;
+	}
+	// The directory relative paths are relative to, absolute, with trailing slash.
+	string base_dir() const
+	{
+		if (base) return base;
+		return getcwd_d()+"/";
+	}
+	
+	static string append_slash(string path)
+	{
+		if (path.endswith("/") || path == "") return path;
+		else return path+"/";
+	}
+	
+	// Removes ./ and ../ components, and double slashes, from the path. Does not follow symlinks.
+	static string normalize_path(const string& path)
+	{
+		// fast path for easy cases (can't just look for "/.", that'd hit the slow path for every /.git)
+		if (!path.contains("/..") && !path.contains("/./") && !path.contains("//"))
+		{
+			if (path == "/.") // I don't think this is a possible input, but better handle it anyways, for completeness
+				return "/";
+			return path;
+		}
+		
+		char * ret = strdup(path);
+		
+		size_t off_in = 0;
+		size_t off_out = 0;
+		while (ret[off_in])
+		{
+			if (ret[off_in] == '/' && ret[off_in+1] == '/')
+			{
+				off_in += 1;
+				continue;
+			}
+			if (ret[off_in] == '/' && ret[off_in+1] == '.')
+			{
+				if (ret[off_in+2] == '/' || ret[off_in+2] == '\0')
+				{
+					off_in += 2;
+					continue;
+				}
+				if (ret[off_in+2] == '.' && (ret[off_in+3] == '/' || ret[off_in+3] == '\0'))
+				{
+					off_in += 3;
+					if (off_out) off_out--;
+					while (off_out && ret[off_out] != '/') off_out--;
+					continue;
+				}
+			}
+			ret[off_out] = ret[off_in];
+			off_in++;
+			off_out++;
+		}
+		if (off_out == 0)         // this throws it out of bounds if input was an empty string, 
+			ret[off_out++] = '/'; // but empty string does not contain /.. so that can't happen
+		ret[off_out] = '\0';
+		return string::create_usurp(ret);
+	}
+	
+	// Input may or may not have slash. Output will not have a slash.
+	static string parent_dir(const string& path)
+	{
+		const char * start = path.c_str();
+		const char * end = (char*)memrchr((void*)path.c_str(), '/', path.length()-1);
+		return string(start, end-start);
+	}
+	
+	// A directory is considered to be inside itself. Don't use . or .. components or double slashes.
+	// Returns false if one path is relative and the other is absolute; this is probably not the desired answer.
+	// A trailing slash will be ignored, on both sides.
+	static bool is_inside(const string& parent, const string& child)
+	{
+		return append_slash(child).startswith(append_slash(parent));
+	}
+	static bool is_same(const string& parent, const string& child)
+	{
+		return append_slash(child) == append_slash(parent);
+	}
+	
+	bool initialized() const { return git_dir && work_tree; }
+	
+	// Paths may, but are not required to, end with a slash. However, they must be absolute.
+	// Configuring the Git directory will also configure the work tree, if it's not set already.
+	void set_git_dir(const string& dir)
+	{
+		git_dir = normalize_path(append_slash(dir));
+		
+		if (!git_dir.endswith("/.git/"))
+			FATAL("GitBSLR: The git directory path must end with .git, it can't be %s\n", git_dir.c_str());
+		
+		if (!work_tree)
+		{
+			// if this repo is a submodule, .git will be accessed via a few extra ../ components
+			// the work tree will be whatever is before the ..s
+			// https://github.com/Alcaro/GitBSLR/issues/16
+			string tmp = parent_dir(dir);
+			while (tmp.endswith("/.."))
+				tmp = string(tmp, tmp.length()-3);
+			set_work_tree(normalize_path(tmp));
+			DEBUG("GitBSLR: Using work tree %s (autodetected)\n", work_tree.c_str());
+		}
+		
+		select_hot_path();
+		
+		if (pending_cache)
+		{
+			if (!load_cache(pending_cache, pending_cache_len))
+				DEBUG("GitBSLR: Inherited cache is from another repository, or corrupt; ignoring it\n");
+			free(pending_cache);
+			pending_cache = NULL;
+		}
+		if (prefetch)
+			start_prefetch();
+	}
+	
+	void set_work_tree(const string& dir)
+	{
+		work_tree = normalize_path(append_slash(dir));
+		if (relative_to_work_tree)
+			base = work_tree;
+		flush();
+		select_hot_path();
+	}
+	
+	// Forgets everything resolve_symlink knows. Call this after removing or renaming anything in the work tree
+	// (or anything a link in it points to).
+	void flush() const
+	{
+		pthread_mutex_lock(&tree_lock);
+		delete tree;
+		tree = NULL;
+		delete inherited_tree;
+		inherited_tree = NULL;
+		for (strmap<real_dir*>::iterator it = real_dirs.begin(); it; ++it)
+			delete it.value();
+		real_dirs.reset();
+		attrs.reset();
+		tree_gen++;
+		pthread_cond_broadcast(&flushed);
+		pthread_mutex_unlock(&tree_lock);
+	}
+	
+	// Forgets what resolve_symlink knows about path, and anything under it or pointing into it. Call this after removing
+	// or renaming it (for a rename, call it on both sides). If links_too is set, all links are forgotten too; a link's
+	// target may go through a link or directory, so those can change what links anywhere else resolve to.
+	// Relative paths are relative to the base directory.
+	void invalidate(const string& path, bool links_too) const
+	{
+		string parent_real;
+		string name;
+		if (locate(path, parent_real, name))
+			invalidate(parent_real, name, links_too);
+		else
+			flush();
+	}
+	
+	// Finds the realpath of the directory path is in, and path's last component; invalidate forgets what's there.
+	// Returns false if that directory is gone too.
+	bool locate(const string& path, string& parent_real, string& name) const
+	{
+		if (known_parent(path, parent_real, name) && name) return true;
+		string abs = normalize_path(path[0] == '/' ? path : base_dir() + path);
+		if (abs.length() > 1 && abs.endswith("/"))
+			abs = string(abs.c_str(), abs.length()-1);
+		string parent = parent_dir(abs);
+		parent_real = realpath_d(parent ? parent : "/");
+		name = abs.c_str() + parent.length() + 1;
+		return parent_real && name;
+	}
+	
+	// Same as above, for what locate returned; possibly in another process, one that shares this one's configuration.
+	void invalidate(const string& parent_real, const string& name, bool links_too) const
+	{
+		invalidation inv(parent_real, name, links_too);
+		
+		pthread_mutex_lock(&tree_lock);
+		if (tree && inv.covers(tree->canon))
+		{
+			delete tree;
+			tree = NULL;
+		}
+		else if (tree)
+			invalidate_children(tree, inv);
+		delete inherited_tree;
+		inherited_tree = NULL;
+		real_dirs.remove_if(stale_real_dir(inv));
+		attrs.reset();
+		// a resolution that started before this may be about to put the old state back in
+		tree_gen++;
+		pthread_mutex_unlock(&tree_lock);
+	}
+	
+	// Forgets the verdict tree, but not the real directory table, which only has absolute paths.
+	// Call this after changing the current directory, unless the base is the work tree.
+	void flush_tree() const
+	{
+		pthread_mutex_lock(&tree_lock);
+		delete tree;
+		tree = NULL;
+		attrs.reset();
+		tree_gen++;
+		pthread_cond_broadcast(&flushed);
+		pthread_mutex_unlock(&tree_lock);
+	}
+	
+private:
+	// If the verdict tree knows the realpath of path's parent directory, returns true, with that and the last component.
+	// It usually does; Git rarely removes something it hasn't looked at.
+	bool known_parent(const string& path, string& parent_real, string& name) const
+	{
+		if (!is_plain_path(path)) return false;
+		pthread_mutex_lock(&tree_lock);
+		const verdict_node* node = tree;
+		const char * iter = path;
+		while (node)
+		{
+			const char * next = strchr(iter, '/');
+			if (!next) break;
+			verdict_node** child = node->children.get(string(iter, next-iter));
+			node = (child ? *child : NULL);
+			iter = next+1;
+		}
+		if (node) parent_real = node->canon;
+		pthread_mutex_unlock(&tree_lock);
+		name = iter;
+		return node;
+	}
+	
+	// What invalidate forgets: the realpath parent_real/name, everything under it, and, if links is set, all links.
+	struct invalidation {
+		string parent_real;
+		string name;
+		string prefix; // parent_real/name/
+		bool links;
+		
+		invalidation(const string& parent_real, const string& name, bool links)
+			: parent_real(parent_real), name(name), prefix(append_slash(parent_real) + name + "/"), links(links) {}
+		// Whether the realpath is the invalidated one, or under it. Doesn't allocate; this runs for every node.
+		bool covers(const string& real) const
+		{
+			if (real.length() >= prefix.length()) return !memcmp(real.c_str(), prefix.c_str(), prefix.length());
+			return real.length() == prefix.length()-1 && !memcmp(real.c_str(), prefix.c_str(), real.length());
+		}
+		// Same, for the entry called entry_name in the directory at dir_real.
+		bool covers(const string& dir_real, const string& entry_name) const
+		{
+			return (dir_real == parent_real && entry_name == name) || covers(dir_real);
+		}
+	};
+	struct stale_node {
+		const invalidation& inv;
+		const verdict_node* parent;
+		stale_node(const invalidation& inv, const verdict_node* parent) : inv(inv), parent(parent) {}
+		bool operator()(const string& name, verdict_node* node) const
+		{
+			if ((inv.links && node->is_link) || inv.covers(parent->canon, name) || inv.covers(node->canon))
+			{
+				delete node;
+				return true;
+			}
+			invalidate_children(node, inv);
+			return false;
+		}
+	};
+	static void invalidate_children(verdict_node* node, const invalidation& inv)
+	{
+		node->children.remove_if(stale_node(inv, node));
+	}
+	struct stale_real_entry {
+		const invalidation& inv;
+		const real_dir* dir;
+		stale_real_entry(const invalidation& inv, const real_dir* dir) : inv(inv), dir(dir) {}
+		bool operator()(const string& name, const real_entry& e) const
+		{
+			return inv.covers(dir->canon, name) || (e.is_link && (inv.links || inv.covers(e.canon)));
+		}
+	};
+	struct stale_real_dir {
+		const invalidation& inv;
+		stale_real_dir(const invalidation& inv) : inv(inv) {}
+		bool operator()(const string& key, real_dir* dir) const
+		{
+			if (inv.covers(dir->canon))
+			{
+				delete dir;
+				return true;
+			}
+			if (dir->has_links || dir->canon == inv.parent_real)
+				dir->entries.remove_if(stale_real_entry(inv, dir));
+			return false;
+		}
+	};
+	
+	static void save_node(cache_writer& w, const verdict_node* node)
+	{
+		w.put_str(node->canon);
+		w.put_u64(node->dev);
+		w.put_u64(node->ino);
+		w.put_u64(node->is_link);
+		w.put_u64(node->verdict);
+		w.put_str(node->target);
+		w.put_u64(node->children.size());
+		for (strmap<verdict_node*>::iterator it = node->children.begin(); it; ++it)
+		{
+			w.put_str(it.key());
+			save_node(w, it.value());
+		}
+	}
+	static verdict_node* load_node(cache_reader& r, size_t& count, int depth)
+	{
+		verdict_node* node = new verdict_node();
+		node->canon = r.get_str();
+		node->dev = r.get_u64();
+		node->ino = r.get_u64();
+		node->is_link = r.get_u64();
+		node->verdict = (verdict_t)r.get_u64();
+		node->target = r.get_str();
+		count++;
+		uint64_t n_children = r.get_u64();
+		if (node->verdict > vd_loop || depth > 4096) r.ok = false;
+		for (uint64_t i=0;i<n_children && r.ok;i++)
+		{
+			string name = r.get_str();
+			node->children[name] = load_node(r, count, depth+1);
+		}
+		return node;
+	}
+	
+	static const uint64_t cache_magic = 0x31656863614342ULL; // "BCache1"
+	
+public:
+	// Writes everything resolve_symlink knows, along with the configuration it depends on.
+	void save_cache(cache_writer& w) const
+	{
+		pthread_mutex_lock(&tree_lock);
+		w.put_u64(cache_magic);
+		w.put_str(work_tree);
+		w.put_str(git_dir);
+		w.put_str(follow);
+		
+		w.put_u64(real_dirs.size());
+		for (strmap<real_dir*>::iterator it = real_dirs.begin(); it; ++it)
+		{
+			const real_dir* dir = it.value();
+			w.put_str(it.key());
+			w.put_str(dir->canon);
+			w.put_u64(dir->entries.size());
+			for (strmap<real_entry>::iterator ent = dir->entries.begin(); ent; ++ent)
+			{
+				const real_entry& e = ent.value();
+				w.put_str(ent.key());
+				w.put_u64(e.is_link);
+				w.put_u64(e.is_dir);
+				w.put_u64(e.dev);
+				w.put_u64(e.ino);
+				w.put_str(e.canon);
+				w.put_str(e.link_target);
+			}
+		}
+		
+		w.put_u64(tree != NULL);
+		if (tree) save_node(w, tree);
+		pthread_mutex_unlock(&tree_lock);
+	}
+	
+	// Takes ownership of data, which must be from malloc, and loads it as soon as the Git directory is known.
+	void set_inherited_cache(uint8_t* data, size_t len)
+	{
+		free(pending_cache);
+		pending_cache = data;
+		pending_cache_len = len;
+		if (initialized())
+		{
+			pending_cache = NULL;
+			if (!load_cache(data, len))
+				DEBUG("GitBSLR: Inherited cache is from another repository, or corrupt; ignoring it\n");
+			free(data);
+		}
+	}
+	
+	// Replaces everything resolve_symlink knows with what save_cache wrote. The verdict tree is only used if it turns out
+	// to have the same root as this process. Returns false, and changes nothing, if the data is corrupt, or from a
+	// process with another configuration.
+	bool load_cache(const uint8_t* data, size_t len)
+	{
+		cache_reader r(data, len);
+		if (r.get_u64() != cache_magic) return false;
+		if (r.get_str() != work_tree || r.get_str() != git_dir || r.get_str() != follow) return false;
+		
+		strmap<real_dir*> new_real_dirs;
+		uint64_t n_dirs = r.get_u64();
+		for (uint64_t i=0;i<n_dirs && r.ok;i++)
+		{
+			real_dir*& dir = new_real_dirs[r.get_str()];
+			if (!dir) dir = new real_dir();
+			dir->canon = r.get_str();
+			uint64_t n_entries = r.get_u64();
+			for (uint64_t j=0;j<n_entries && r.ok;j++)
+			{
+				real_entry& e = dir->entries[r.get_str()];
+				e.is_link = r.get_u64();
+				if (e.is_link) dir->has_links = true;
+				e.is_dir = r.get_u64();
+				e.dev = r.get_u64();
+				e.ino = r.get_u64();
+				e.canon = r.get_str();
+				e.link_target = r.get_str();
+			}
+		}
+		size_t n_nodes = 0;
+		verdict_node* new_tree = (r.get_u64() ? load_node(r, n_nodes, 0) : NULL);
+		
+		if (!r.ok || r.pos != r.len)
+		{
+			for (strmap<real_dir*>::iterator it = new_real_dirs.begin(); it; ++it)
+				delete it.value();
+			delete new_tree;
+			return false;
+		}
+		
+		flush();
+		pthread_mutex_lock(&tree_lock);
+		for (strmap<real_dir*>::iterator it = new_real_dirs.begin(); it; ++it)
+			real_dirs[it.key()] = it.value();
+		inherited_tree = new_tree;
+		pthread_mutex_unlock(&tree_lock);
+		DEBUG("GitBSLR: Inherited %lu directories and %lu verdicts\n", (unsigned long)n_dirs, (unsigned long)n_nodes);
+		return true;
+	}
+	
+	// If the process forks while another thread holds the lock, the child would deadlock the first time it needs it.
+	// gitbslr.so calls these from pthread_atfork.
+	void before_fork() const { pthread_mutex_lock(&tree_lock); }
+	void after_fork_parent() const { pthread_mutex_unlock(&tree_lock); }
+	void after_fork_child()
+	{
+		pthread_mutex_unlock(&tree_lock);
+		// threads don't survive fork
+		prefetch_running = false;
+	}
+	
+	// Call only on paths known to exist. If it contains a /.git/, the Git directory is configured. This may set the work tree.
+	void try_init(const string& path)
+	{
+		if (git_dir)
+			return;
+		if (path.endswith("/.git"))
+		{
+			DEBUG("GitBSLR: Using git dir %s (autodetected)\n", path.c_str());
+			set_git_dir(path);
+			return;
+		}
+		if (path.contains("/.git/"))
+		{
+			const char * gitdir_start = path.c_str();
+			const char * gitdir_end = strstr(gitdir_start, "/.git/") + strlen("/.git/");
+			DEBUG("GitBSLR: Using git dir %.*s (autodetected)\n", (int)(gitdir_end-gitdir_start), gitdir_start);
+			set_git_dir(string(gitdir_start, gitdir_end-gitdir_start));
+			return;
+		}
+	}
+	
+	// This one does not consider GITBSLR_FOLLOW.
+	// If the Git directory or work tree are not yet known, this function won't return that.
+	path_class_t classify(const string& path, bool fatal_unknown) const
+	{
+		if (path[0] != '/')
+			return classify(normalize_path(base_dir() + path), fatal_unknown);
+		
+		if (is_inside("/usr/share/git-core/", path))
+			return cls_git_dir;
+		if (git_dir && is_inside(git_dir, path))
+			return cls_git_dir;
+		if (work_tree && is_inside(work_tree, path))
+			return cls_work_tree;
+		// git status in a submodule will lstat the work tree and git dir, and all parents
+		// https://github.com/Alcaro/GitBSLR/issues/16
+		if (git_dir && is_inside(path, git_dir))
+			return cls_git_dir;
+		if (work_tree && is_inside(path, work_tree))
+			return cls_work_tree;
+		if (git_config_path_1 && is_same(path, git_config_path_1))
+			return cls_git_dir;
+		if (git_config_path_2 && is_same(path, git_config_path_2))
+			return cls_git_dir;
+		if (fatal_unknown)
+		{
+			if (!git_dir || !work_tree)
+				FATAL("GitBSLR: unexpected access to %s before locating Git directory and/or work tree. "
+				      "Either you're missing GITBSLR_GIT_DIR and/or GITBSLR_WORK_TREE, or you found a GitBSLR bug. "
+				      "If latter, please report it: " BUG_URL "\n",
+				      path.c_str());
+			else
+				FATAL("GitBSLR: unexpected access to %s; should only be in %s or %s. "
+				      "Either you're missing GITBSLR_GIT_DIR and/or GITBSLR_WORK_TREE, or you found a GitBSLR bug. "
+				      "If latter, please report it: " BUG_URL "\n",
+				      path.c_str(), work_tree.c_str(), git_dir.c_str());
+		}
+		return cls_unknown;
+	}
+	
+	bool is_in_git_dir(const string& path) const { return classify(path, true) == cls_git_dir; }
+	
+	// Input: A path in the work tree, absolute or relative to the base directory. Output: Same path, relative to work tree.
+	// Like link_force_inline, this assumes the base directory is the work tree root.
+	string virtual_path(const string& path) const
+	{
+		if (is_inside(work_tree, path)) return string(path.c_str() + work_tree.length());
+		return path;
+	}
+	
+	// Whether the verdict tree knows the path is under an inlined link, i.e. in a tree from outside the work tree.
+	bool under_inlined_link(const string& path) const
+	{
+		pthread_mutex_lock(&tree_lock);
+		verdict_node* node = tree;
+		bool ret = false;
+		const char * iter = path;
+		while (node && !ret)
+		{
+			const char * next = strchr(iter, '/');
+			if (!next) break;
+			verdict_node** child = node->children.get(string(iter, next-iter));
+			node = (child ? *child : NULL);
+			ret = (node && node->is_link);
+			iter = next+1;
+		}
+		pthread_mutex_unlock(&tree_lock);
+		return ret;
+	}
+	
+	// Whether the verdict tree knows that the path's realpath, or if the path isn't a directory or link,
+	// its parent's, is outside the work tree, i.e. it's under an inlined link to an external tree.
+	bool in_external_tree(const string& path) const
+	{
+		pthread_mutex_lock(&tree_lock);
+		verdict_node* node = tree;
+		const char * iter = path;
+		while (node)
+		{
+			const char * next = strchrnul(iter, '/');
+			verdict_node** child = node->children.get(string(iter, next-iter));
+			if (!child) break;
+			node = *child;
+			if (!*next) break;
+			iter = next+1;
+		}
+		// if the walk stopped early, the node is for some grandparent, and the path itself is unknown
+		bool ret = (node && !strchr(iter, '/') && !is_inside(work_tree, node->canon));
+		pthread_mutex_unlock(&tree_lock);
+		return ret;
+	}
+	
+	// GITBSLR_ATTR_TTL's cache. attr_get returns false if the path isn't cached, or is older than the TTL.
+	template<typename stat_t> bool attr_get(const string& key, stat_t* buf) const
+	{
+		pthread_mutex_lock(&tree_lock);
+		attr_entry* entry = attrs.get(key);
+		bool ret = (entry && entry->time_of(buf) && time_ns() - entry->time_of(buf) < attr_ttl);
+		if (ret) *buf = *entry->data(buf);
+		pthread_mutex_unlock(&tree_lock);
+		return ret;
+	}
+	template<typename stat_t> void attr_put(const string& key, const stat_t* buf, unsigned gen) const
+	{
+		pthread_mutex_lock(&tree_lock);
+		if (gen == tree_gen)
+		{
+			attr_entry& entry = attrs[key];
+			*entry.data((stat_t*)NULL) = *buf;
+			entry.time_of((stat_t*)NULL) = time_ns();
+		}
+		pthread_mutex_unlock(&tree_lock);
+	}
+	unsigned get_tree_gen() const
+	{
+		pthread_mutex_lock(&tree_lock);
+		unsigned ret = tree_gen;
+		pthread_mutex_unlock(&tree_lock);
+		return ret;
+	}
+	
+	// Call after a resolution, if trace is set; start is from time_ns.
+	void trace_resolution(const string& path, uint64_t start) const
+	{
+		if (trace->resolved(start))
+			trace->region(under_inlined_link(path) ? "inlined_tree" : "resolve_symlink", virtual_path(path), start);
+	}
+	
+	//Returns why the GITBSLR_FOLLOW rules are invalid, or NULL if they're fine.
+	static const char * follow_error(const char * rules)
+	{
+		if (!rules || !*rules) return NULL;
+		while (true)
+		{
+			const char * next = strchrnul(rules, ':');
+			if (*rules == '!') rules++;
+			if (*rules == ':')
+				return "empty GITBSLR_FOLLOW entries are not allowed";
+			if (next > rules && next[-1] == '*' && next-1 > rules && next[-2] != '/')
+				return "GITBSLR_FOLLOW entries can't end with * unless they end with /*";
+			if (!*next) return NULL;
+			rules = next+1;
+		}
+	}
+	
+	//Input: A path to a symlink, relative to the base directory, no trailing slash.
+	//Output: Whether GITBSLR_FOLLOW says that path should be inlined. False = it's a link.
+	//If prof is set, the matching rule, if any, is counted.
+	//If gave_up is set, a current directory outside the work tree isn't fatal; *gave_up is set, and the answer is meaningless.
+	bool link_force_inline(const string& path, profiler* prof = NULL, bool* gave_up = NULL) const
+	{
+		if (!follow) return false;
+		const char * rules = follow;
+		
+		string cwd = base_dir();
+		if (!is_inside(work_tree, cwd))
+		{
+			if (gave_up)
+			{
+				*gave_up = true;
+				return false;
+			}
+			FATAL("GitBSLR: current directory %s should be in work tree %s\n", cwd.c_str(), work_tree.c_str());
+		}
+		
+		//path is relative to cwd
+		//path_rel is relative to work tree
+		//path_abs is work tree plus path_rel
+		
+		string path_rel = append_slash(string(cwd.c_str()+work_tree.length(), cwd.length()-work_tree.length())) + path;
+		string path_abs = work_tree + path_rel;
+		
+		bool ret = false; // no matching rule -> default to keeping it as a link
+		string matched_rule;
+		
+		while (true)
+		{
+			const char * next = strchrnul(rules, ':');
+			const char * end = next;
+			const char * rule = rules;
+			
+			bool ret_this = true;
+			bool wildcard = false;
+			if (*rules == '!') { rules++; ret_this = false; }
+			
+			// this intentionally accepts * as an entry; follow_error rejects anything else ending with * but not /*
+			if (end > rules && end[-1] == '*')
+			{
+				end--;
+				wildcard = true;
+			}
+			
+			if (end > rules && end[-1] == '/') end--; // ignore trailing slashes
+			
+			// keep running if the rule matches, so the last one wins
+			if ((memcmp(path_rel.c_str(), rules, end-rules)==0 && (wildcard || (size_t)(end-rules) == path_rel.length())) ||
+			    (memcmp(path_abs.c_str(), rules, end-rules)==0 && (wildcard || (size_t)(end-rules) == path_abs.length())))
+			{
+				ret = ret_this;
+				if (prof) matched_rule = string(rule, next-rule);
+			}
+			
+			if (!*next)
+			{
+				if (prof && matched_rule) prof->rule(matched_rule);
+				return ret;
+			}
+			rules = next+1;
+		}
+	}
+	
+	//Input:
+	// Any virtual path.
+	//Output:
+	// If that path should refer to a symlink, return what it points to, relative to the presumed link's parent directory.
+	// If it doesn't exist, or should be a normal file or directory (not a link), return a blank string.
+	//The function may not call lstat or readlink, that'd yield infinite recursion. It may call readlink_o, which is the real readlink.
+	//This is what every interposed function uses. If GITBSLR_VERIFY is set, the answer is checked against resolve_symlink_ref.
+	string resolve_symlink(const string& path) const
+	{
+		if (follow) return resolve_symlink_t<true>(path);
+		else return resolve_symlink_t<false>(path);
+	}
+	// has_follow must be whether GITBSLR_FOLLOW has any rules.
+	template<bool has_follow> string resolve_symlink_t(const string& path) const
+	{
+		string ret = (is_plain_path(path) ? resolve_symlink_tree<has_follow>(path, profile) : resolve_symlink_ref(path, profile));
+		if (verify)
+			verify_resolution(path, ret);
+		return ret;
+	}
+	
+	// Relative, no . or .. components, no double or trailing slash. That's what Git uses; anything else goes to the reference.
+	static bool is_plain_path(const string& path)
+	{
+		const char * iter = path;
+		if (!*iter || *iter == '/') return false;
+		while (true)
+		{
+			const char * next = strchrnul(iter, '/');
+			size_t len = next-iter;
+			if (len == 0) return false;
+			if (iter[0] == '.' && (len == 1 || (len == 2 && iter[1] == '.'))) return false;
+			if (!*next) return true;
+			iter = next+1;
+		}
+	}
+	
+	static string join_real(const string& dir, const char * name, size_t len)
+	{
+		if (dir == "/") return string("/") + string(name, len);
+		return dir + "/" + string(name, len);
+	}
+	
+	static string inode_key(dev_t dev, ino_t ino)
+	{
+		char buf[64];
+		sprintf(buf, "%llx:%llx", (unsigned long long)dev, (unsigned long long)ino);
+		return buf;
+	}
+	
+	//Looks up name in the real directory at canon, identified by dev and ino. Returns false if it doesn't exist,
+	// or isn't accessible; such results aren't remembered.
+	bool lookup_real(const string& canon, dev_t dev, ino_t ino, const char * name, size_t name_len, real_entry& out) const
+	{
+		string key = inode_key(dev, ino);
+		string name_s = string(name, name_len);
+		
+		pthread_mutex_lock(&tree_lock);
+		unsigned gen = tree_gen;
+		real_dir** dir = real_dirs.get(key);
+		real_entry* entry = (dir && (*dir)->canon == canon ? (*dir)->entries.get(name_s) : NULL);
+		if (entry) out = *entry;
+		pthread_mutex_unlock(&tree_lock);
+		if (entry) return true;
+		
+		string real = join_real(canon, name, name_len);
+		struct stat st;
+		if (lstat_o_3264(real, &st) < 0) return false;
+		out.is_link = S_ISLNK(st.st_mode);
+		if (out.is_link)
+		{
+			out.canon = realpath_d(real);
+			if (!out.canon) return false;
+			out.link_target = readlink_d(real);
+			if (stat_3264(out.canon, &st) < 0) return false;
+		}
+		out.is_dir = S_ISDIR(st.st_mode);
+		out.dev = st.st_dev;
+		out.ino = st.st_ino;
+		
+		pthread_mutex_lock(&tree_lock);
+		if (gen == tree_gen)
+		{
+			real_dir*& newdir = real_dirs[key];
+			if (!newdir)
+			{
+				newdir = new real_dir();
+				newdir->canon = canon;
+			}
+			if (newdir->canon == canon)
+			{
+				newdir->entries[name_s] = out;
+				if (out.is_link) newdir->has_links = true;
+			}
+		}
+		pthread_mutex_unlock(&tree_lock);
+		return true;
+	}
+	
+	//Checks that the base directory, realpath root_abs, is in the work tree. If not, it's a GitBSLR bug, unless
+	// give_up is set; then it returns false. In libgitbslr, it sets resolve_errno and returns false instead.
+	bool check_root(const string& root_abs, bool give_up) const
+	{
+		if (is_inside(work_tree, root_abs)) return true;
+		if (give_up) return false;
+		if (library)
+		{
+			resolve_errno = (root_abs ? EINVAL : errno);
+			return false;
+		}
+		FATAL("GitBSLR: internal error, attempted symlink check with cwd (%s) outside worktree (%s). "
+			"Please report this bug: " BUG_URL "\n",
+			root_abs.c_str(), work_tree.c_str());
+	}
+	
+	//Creates the verdict tree's root, or adopts the inherited one. Call with tree_lock held.
+	//Returns false if that's impossible, under the same conditions as check_root.
+	bool create_tree(bool give_up) const
+	{
+		string root_abs = realpath_d(in_base("."));
+		if (!check_root(root_abs, give_up)) return false;
+		if (inherited_tree && inherited_tree->canon == root_abs)
+		{
+			tree = inherited_tree;
+		}
+		else
+		{
+			struct stat st;
+			if (stat_3264(root_abs, &st) < 0)
+			{
+				if (give_up) return false;
+				if (library)
+				{
+					resolve_errno = errno;
+					return false;
+				}
+				FATAL("GitBSLR: can't access %s: %s\n", root_abs.c_str(), strerror(errno));
+			}
+			tree = new verdict_node();
+			tree->canon = root_abs;
+			tree->dev = st.st_dev;
+			tree->ino = st.st_ino;
+			tree->verdict = vd_dir;
+			delete inherited_tree;
+		}
+		inherited_tree = NULL;
+		return true;
+	}
+	
+	//Same answers as resolve_symlink_ref, but the realpath of every directory and link is kept in the verdict tree,
+	// so only the components below the nearest known ancestor need any work, and that work is shared between every
+	// alias of the same real directory. Links and directories also remember their own verdict. Path must be plain.
+	//If prefetching is set, a current directory outside the work tree isn't fatal; nothing is resolved.
+	template<bool has_follow>
+	string resolve_symlink_tree(const string& path, profiler* prof, bool prefetching = false) const
+	{
+		const char * start = path;
+		size_t n = 1;
+		for (const char * iter = start; *iter; iter++)
+		{
+			if (*iter == '/') n++;
+		}
+		
+		// canon[i] is the realpath of the first i components, real[i] what's there; name[i] and name_len[i] are the i-th component
+		string* canon = new string[n+1];
+		real_entry* real = new real_entry[n+1];
+		const char ** name = new const char*[n+1];
+		size_t* name_len = new size_t[n+1];
+		const char * iter = start;
+		for (size_t i=1;i<=n;i++)
+		{
+			const char * next = strchrnul(iter, '/');
+			name[i] = iter;
+			name_len[i] = next-iter;
+			iter = next+1;
+		}
+		
+		pthread_mutex_lock(&tree_lock);
+		if (!tree && !create_tree(prefetching))
+		{
+			pthread_mutex_unlock(&tree_lock);
+			delete[] canon;
+			delete[] real;
+			delete[] name;
+			delete[] name_len;
+			return "";
+		}
+		unsigned gen = tree_gen;
+		verdict_node* node = tree;
+		canon[0] = node->canon;
+		real[0].is_dir = true;
+		real[0].dev = node->dev;
+		real[0].ino = node->ino;
+		size_t known = 0;
+		while (known < n)
+		{
+			verdict_node** child = node->children.get(string(name[known+1], name_len[known+1]));
+			if (!child) break;
+			node = *child;
+			known++;
+			canon[known] = node->canon;
+			real[known].is_link = node->is_link;
+			real[known].is_dir = true; // not necessarily true for the last one, but nothing looks at that
+			real[known].dev = node->dev;
+			real[known].ino = node->ino;
+		}
+		bool leaf_known = (known == n && node->verdict != vd_unknown);
+		string ret = node->target;
+		pthread_mutex_unlock(&tree_lock);
+		
+		if (leaf_known)
+		{
+			if (prof && real[n].is_link) prof->link(path);
+			delete[] canon;
+			delete[] real;
+			delete[] name;
+			delete[] name_len;
+			return ret;
+		}
+		ret = "";
+		
+		bool exists = true;
+		for (size_t i=known+1;i<=n;i++)
+		{
+			if (!lookup_real(canon[i-1], real[i-1].dev, real[i-1].ino, name[i], name_len[i], real[i]) ||
+			    (i < n && !real[i].is_dir))
+			{
+				exists = false;
+				break;
+			}
+			canon[i] = (real[i].is_link ? real[i].canon : join_real(canon[i-1], name[i], name_len[i]));
+		}
+		
+		bool leaf_is_link = real[n].is_link;
+		verdict_t verdict = vd_dir;
+		if (exists)
+		{
+			const string& path_abs = canon[n];
+			string path_linktarget;
+			if (leaf_is_link)
+			{
+				// if the leaf's node was already known, it didn't go through lookup_real
+				if (known == n) lookup_real(canon[n-1], real[n-1].dev, real[n-1].ino, name[n], name_len[n], real[n]);
+				path_linktarget = real[n].link_target;
+			}
+			
+			if (is_inside(git_dir, path_abs) || is_inside("/usr/share/git-core/", path_abs))
+			{
+				// git dir -> return truth
+				ret = path_linktarget;
+				verdict = (ret ? vd_link : leaf_is_link ? vd_inline : vd_dir);
+			}
+			else
+			{
+				if (prof && path_linktarget) prof->link(path);
+				verdict = compute_verdict<has_follow>(path, canon, real, n, path_linktarget, prof, prefetching, ret);
+				// Git changed the current directory; whatever this found is wrong
+				if (verdict == vd_unknown) exists = false;
+			}
+		}
+		
+		pthread_mutex_lock(&tree_lock);
+		if (exists && gen == tree_gen)
+		{
+			// the leaf is only worth remembering if it's a directory or link; there's no point filling the tree with files
+			size_t n_nodes = (leaf_is_link || known == n || real[n].is_dir ? n : n-1);
+			node = tree;
+			for (size_t i=1;i<=n_nodes;i++)
+			{
+				verdict_node*& child = node->children[string(name[i], name_len[i])];
+				if (!child)
+				{
+					child = new verdict_node();
+					child->canon = canon[i];
+					child->dev = real[i].dev;
+					child->ino = real[i].ino;
+					child->is_link = real[i].is_link;
+				}
+				node = child;
+			}
+			if (n_nodes == n)
+			{
+				node->verdict = verdict;
+				node->target = ret;
+			}
+		}
+		pthread_mutex_unlock(&tree_lock);
+		
+		delete[] canon;
+		delete[] real;
+		delete[] name;
+		delete[] name_len;
+		return ret;
+	}
+	
+	//The second half of resolve_symlink_ref, given the realpath of the path and all its parents, and what's there.
+	//Returns the verdict; if that's vd_link or vd_loop, ret is set to the target.
+	//If prefetching is set and the current directory isn't in the work tree, it returns vd_unknown.
+	template<bool has_follow>
+	verdict_t compute_verdict(const string& path, const string* canon, const real_entry* real, size_t n,
+	                          const string& path_linktarget, profiler* prof, bool prefetching, string& ret) const
+	{
+		const string& path_abs = canon[n];
+		
+		// if the path is the same as one of its parents, it's a link
+		// the parents' inodes are already known, so only a matching inode needs its realpath compared; that's only
+		// different if the same directory is mounted in several places
+		for (size_t i=0;i<n;i++)
+		{
+			if (real[i].ino == real[n].ino && real[i].dev == real[n].dev && canon[i] == path_abs)
+			{
+				if (i == n-1) ret = ".";
+				else
+				{
+					ret = "..";
+					for (size_t j=i+2;j<n;j++)
+						ret += "/..";
+				}
+				return vd_loop;
+			}
+		}
+		
+		if (!path_linktarget) return vd_dir;
+		
+		// if it'd point outside the repo, it's not a link
+		bool target_is_in_repo = false;
+		for (size_t i=0;i<n && !target_is_in_repo;i++)
+		{
+			size_t len = canon[i].length();
+			target_is_in_repo = (path_abs.length() > len && path_abs[len] == '/' && !memcmp(path_abs.c_str(), canon[i].c_str(), len));
+		}
+		if (!target_is_in_repo) return vd_inline;
+		if (has_follow)
+		{
+			bool gave_up = false;
+			bool force_inline = link_force_inline(path, prof, prefetching ? &gave_up : NULL);
+			if (gave_up) return vd_unknown;
+			if (force_inline) return vd_inline;
+		}
+		
+		// if the link's target is absolute, or the realpath is not in the work dir but the target is,
+		// ignore readlink and create a new path
+		if (path_linktarget[0]=='/' || !canon[n-1].startswith(work_tree))
+		{
+			const string& source_virt = path;
+			string target_virt = string(path_abs.c_str() + strlen(canon[0])+1);
+			
+			size_t start = 0;
+			for (size_t i=0;source_virt[i] == target_virt[i];i++)
+			{
+				if (source_virt[i] == '/') start = i+1;
+			}
+			
+			string up;
+			const char * next = strchr(source_virt.c_str()+start, '/');
+			while (next)
+			{
+				up += "../";
+				next = strchr(next+1, '/');
+			}
+			ret = up + (target_virt.c_str()+start);
+		}
+		else
+		{
+			ret = path_linktarget;
+		}
+		return vd_link;
+	}
+	
+	//Same as resolve_symlink, but slower, and obviously correct (or at least obviously matching GitBSLR's documented behavior).
+	//Don't optimize this one; it's the reference that GITBSLR_VERIFY compares the real implementation against.
+	//If prof is set, links and GITBSLR_FOLLOW rules are counted there.
+	string resolve_symlink_ref(string path, profiler* prof = NULL) const
+	{
+		//algorithm:
+		//if the path is inside git directory:
+		// tell the truth
+		//for each prefix of the path:
+		// if path is the same thing as prefix (realpath identical):
+		//  it's a link
+		// if path is a link, points to inside prefix, and GITBSLR_FOLLOW doesn't say to inline it:
+		//  it's a link (but check realpath of all prefixes to determine where it leads)
+		//otherwise, it's not a link
+		
+		string path_linktarget = readlink_d(in_base(path));
+		
+		string root_abs = realpath_d(in_base("."));
+		if (!check_root(root_abs, false)) return "";
+		
+		string path_abs = realpath_d(in_base(path)); // if 'path' is a link, this refers to the link target
+		if (!path_abs) return ""; // nonexistent -> not a symlink
+		if (is_inside(git_dir, path_abs)) return path_linktarget; // git dir -> return truth
+		if (is_inside("/usr/share/git-core/", path_abs)) return path_linktarget; // git likes reading some random stuff here, let it
+		if (is_same(work_tree, path)) return ""; // work tree isn't a link
+		if (is_inside(work_tree, path))
+			path = string(path.c_str() + strlen(work_tree)); // unreachable on ubuntu 21.10 and 22.04, but can show up on 16.04
+		
+		if (path[0] == '/')
+			FATAL("GitBSLR: internal error, unexpected absolute path %s. Please report this bug: " BUG_URL "\n", path.c_str());
+		
+		if (prof && path_linktarget) prof->link(path);
+		
+		const char * start = path;
+		const char * iter = start;
+		
+		bool target_is_in_repo = false;
+		
+		while (true)
+		{
+			const char * next = strchrnul(iter+1, '/');
+			
+			string newpath = string(start, iter-start);
+			if (newpath == "") newpath = ".";
+			string newpath_abs = realpath_d(in_base(newpath));
+			
+			// if this path is the same as the link target,
+			if (newpath_abs == path_abs)
+			{
+				// it's a link
+				if (!*next) return ".";
+				string ret;
+				while (*next)
+				{
+					ret += "../";
+					next = strchrnul(next+1, '/');
+				}
+				return string(ret, ret.length()-1);
+			}
+			
+			//if it's originally a symlink, and points to inside the repo,
+			//it's a candidate for inlining - but the above check overrides it, if necessary
+			if (path_linktarget && path_abs.startswith(newpath_abs+"/"))
+				target_is_in_repo = true;
+			
+			iter = next;
+			
+			if (iter[0] == '\0' || (iter[0] == '/' && iter[1] == '\0'))
+			{
+				if (!target_is_in_repo) return ""; // if it'd point outside the repo, it's not a link
+				if (link_force_inline(path, prof)) return ""; // if GITBSLR_FOLLOW says inline, it's not a link
+				
+				// if the link's target is absolute, or the realpath is not in the work dir but the target is,
+				// ignore readlink and create a new path
+				if (path_linktarget[0]=='/' || !newpath_abs.startswith(work_tree))
+				{
+					// path is virtual path to link
+					// path_abs is real path to link, including work tree
+					string& source_virt = path; // rename this variable
+					string target_virt = string(path_abs.c_str() + strlen(root_abs)+1);
+					
+					// if <wtree>/a/b/c points to <wtree>/a/d, emit ../d, not ../../a/d
+					size_t start = 0;
+					for (size_t i=0;source_virt[i] == target_virt[i];i++)
+					{
+						if (source_virt[i] == '/') start = i+1;
+					}
+					
+					string up;
+					const char * next = strchr(source_virt.c_str()+start, '/');
+					while (next)
+					{
+						up += "../";
+						next = strchr(next+1, '/');
+					}
+					return up + (target_virt.c_str()+start);
+				}
+				else
+				{
+					return path_linktarget;
+				}
+			}
+		}
+	}
+	
+	//Git reads the index, then lstats everything in it, in order. The prefetch thread reads the index too, and resolves
+	// everything ahead of Git, so Git finds it in the verdict tree and real directory table.
+	void start_prefetch()
+	{
+		if (prefetch_running) return;
+		prefetch_stop = false;
+		if (pthread_create(&prefetch_thread, NULL, prefetch_main, this) != 0)
+		{
+			DEBUG("GitBSLR: couldn't start prefetch thread\n");
+			return;
+		}
+		prefetch_running = true;
+	}
+	
+	void stop_prefetch()
+	{
+		if (!prefetch_running) return;
+		prefetch_stop = true;
+		pthread_mutex_lock(&tree_lock);
+		pthread_cond_broadcast(&flushed);
+		pthread_mutex_unlock(&tree_lock);
+		pthread_join(prefetch_thread, NULL);
+		prefetch_running = false;
+	}
+	
+private:
+	static void* prefetch_main(void* userdata)
+	{
+		path_handler* self = (path_handler*)userdata;
+		self->prefetch_index();
+		if (self->count_stats) count_calls(self->stats.prefetch, thread_fs_calls);
+		return NULL;
+	}
+	
+	// Index paths are relative to the work tree, so they're only useful once the base directory is the work tree root;
+	// Git sometimes finds the Git directory before changing to it. Returns false if it doesn't happen within a second.
+	bool prefetch_wait_for_root() const
+	{
+		for (int i=0;i<100;i++)
+		{
+			if (prefetch_stop) return false;
+			if (base_dir() == work_tree) return true;
+			
+			struct timespec until;
+			clock_gettime(CLOCK_REALTIME, &until);
+			until.tv_nsec += 10*1000*1000;
+			if (until.tv_nsec >= 1000*1000*1000) { until.tv_sec++; until.tv_nsec -= 1000*1000*1000; }
+			pthread_mutex_lock(&tree_lock);
+			if (!prefetch_stop) pthread_cond_timedwait(&flushed, &tree_lock, &until);
+			pthread_mutex_unlock(&tree_lock);
+		}
+		return false;
+	}
+	
+	static uint32_t read_be32(const uint8_t * p) { return (uint32_t)p[0]<<24 | p[1]<<16 | p[2]<<8 | p[3]; }
+	
+	void prefetch_index() const
+	{
+		string index_path = git_dir + "index";
+		int fd = open(index_path, O_RDONLY);
+		if (fd < 0) return;
+		struct stat st;
+		if (fstat(fd, &st) < 0 || st.st_size < 12) { close(fd); return; }
+		size_t size = st.st_size;
+		uint8_t* data = malloc(size);
+		size_t pos = 0;
+		while (pos < size)
+		{
+			ssize_t n = read(fd, data+pos, size-pos);
+			if (n <= 0) break;
+			pos += n;
+		}
+		close(fd);
+		
+		uint32_t version = read_be32(data+4);
+		if (pos != size || memcmp(data, "DIRC", 4) != 0 || version < 2 || version > 4)
+		{
+			DEBUG("GitBSLR: not prefetching, %s isn't an index Git understands\n", index_path.c_str());
+			free(data);
+			return;
+		}
+		uint32_t n_entries = read_be32(data+8);
+		
+		// the object hash isn't in the index, it's in the config
+		size_t hash_len = 20;
+		FILE* config = fopen(git_dir + "config", "r");
+		if (config)
+		{
+			char line[256];
+			while (fgets(line, sizeof(line), config))
+			{
+				if (strstr(line, "objectformat") && strstr(line, "sha256")) hash_len = 32;
+			}
+			fclose(config);
+		}
+		
+		DEBUG("GitBSLR: prefetching %u paths from %s\n", n_entries, index_path.c_str());
+		if (!prefetch_wait_for_root())
+		{
+			DEBUG("GitBSLR: not prefetching, current directory isn't %s\n", work_tree.c_str());
+			free(data);
+			return;
+		}
+		unsigned gen = tree_gen;
+		
+		// ctime, mtime, dev, ino, mode, uid, gid, size, hash, flags
+		size_t fixed_len = 40 + hash_len + 2;
+		string path;
+		pos = 12;
+		uint32_t i;
+		for (i=0;i<n_entries && !prefetch_stop;i++)
+		{
+			if (pos + fixed_len > size) break;
+			const uint8_t * entry = data+pos;
+			uint16_t flags = entry[fixed_len-2]<<8 | entry[fixed_len-1];
+			size_t name_off = fixed_len + ((flags & 0x4000) && version >= 3 ? 2 : 0);
+			if (pos + name_off >= size) break;
+			const char * name = (const char*)entry + name_off;
+			
+			if (version == 4)
+			{
+				// path is compressed as a number of bytes to remove from the previous path, then a suffix
+				size_t strip = 0;
+				const uint8_t * iter = (const uint8_t*)name;
+				uint8_t c = *iter++;
+				strip = c & 127;
+				while (c & 128)
+				{
+					c = *iter++;
+					strip = ((strip+1) << 7) | (c & 127);
+				}
+				if (strip > path.length()) break;
+				const char * suffix = (const char*)iter;
+				size_t suffix_len = strnlen(suffix, data+size-iter);
+				path = string(path.c_str(), path.length()-strip) + string(suffix, suffix_len);
+				pos = (suffix + suffix_len + 1) - (const char*)data;
+			}
+			else
+			{
+				size_t name_len = strnlen(name, size-pos-name_off);
+				path = string(name, name_len);
+				pos += (name_off + name_len + 8) & ~7;
+			}
+			
+			// a chdir or checkout invalidates the tree; the former may make relative paths mean something else
+			if (gen != tree_gen)
+			{
+				if (!prefetch_wait_for_root()) break;
+				gen = tree_gen;
+			}
+			if (is_plain_path(path))
+			{
+				if (follow) resolve_symlink_tree<true>(path, NULL, true);
+				else resolve_symlink_tree<false>(path, NULL, true);
+			}
+		}
+		DEBUG("GitBSLR: prefetched %u of %u paths\n", i, n_entries);
+		free(data);
+	}
+	
+public:
+	//Runs the reference algorithm and compares it to what the optimized one said. If they differ, prints everything
+	// that could be relevant and terminates; continuing would make Git act on an answer that's wrong one way or another.
+	void verify_resolution(const string& path, const string& actual) const
+	{
+		string expected = resolve_symlink_ref(path);
+		if (expected == actual)
+			return;
+		
+		string cwd = base_dir();
+		FATAL("GitBSLR: GITBSLR_VERIFY mismatch for %s\n"
+		      "  reference: %s%s\n"
+		      "  optimized: %s%s\n"
+		      "  cwd: %s\n"
+		      "  work tree: %s\n"
+		      "  git dir: %s\n"
+		      "  GITBSLR_FOLLOW: %s\n"
+		      "This is a GitBSLR bug, please report it: " BUG_URL "\n",
+		      path.c_str(),
+		      expected ? "link to " : "not a link", expected.c_str(),
+		      actual ? "link to " : "not a link", actual.c_str(),
+		      cwd.c_str(), work_tree.c_str(), git_dir.c_str(), follow ? follow.c_str() : "(unset)");
+	}
+	
+	//Everything below is the same as the corresponding libc function, except they return what Git should see.
+	//gitbslr.so's lstat and readlink go straight to these. Relative paths are relative to the base directory.
+	
+	int lstat(const char * fn_name, const char * path, struct stat* buf) { return (this->*lstat_fn)(fn_name, path, buf); }
+#if HAVE_STAT64
+	int lstat(const char * fn_name, const char * path, struct stat64* buf) { return (this->*lstat64_fn)(fn_name, path, buf); }
+#endif
+	ssize_t readlink(const char * path, char * buf, size_t bufsiz) { return (this->*readlink_fn)(path, buf, bufsiz); }
+	
+private:
+	//The above run for every file Git looks at, so they're compiled once per combination of the settings that matter,
+	// and the right one is picked whenever one of those changes:
+	// debug - GITBSLR_DEBUG is set; if not, the debug output disappears entirely
+	// has_follow - GITBSLR_FOLLOW has any rules; if not, link_force_inline isn't even called
+	// known - the Git directory and work tree are known; until they are, everything is passed through unchanged
+	// stats - calls are counted (count_stats); if not, there are no shared writes at all
+	int (path_handler::*lstat_fn)(const char * fn_name, const char * path, struct stat* buf);
+#if HAVE_STAT64
+	int (path_handler::*lstat64_fn)(const char * fn_name, const char * path, struct stat64* buf);
+#endif
+	ssize_t (path_handler::*readlink_fn)(const char * path, char * buf, size_t bufsiz);
+	
+	template<bool debug, bool has_follow, bool known, bool stats> void select_hot_path_4()
+	{
+		lstat_fn = &path_handler::lstat_hot<debug, has_follow, known, stats, struct stat>;
+#if HAVE_STAT64
+		lstat64_fn = &path_handler::lstat_hot<debug, has_follow, known, stats, struct stat64>;
+#endif
+		readlink_fn = &path_handler::readlink_hot<debug, has_follow, known, stats>;
+	}
+	template<bool debug, bool has_follow, bool known> void select_hot_path_3()
+	{
+		if (count_stats) select_hot_path_4<debug, has_follow, known, true>();
+		else select_hot_path_4<debug, has_follow, known, false>();
+	}
+	template<bool debug, bool has_follow> void select_hot_path_2()
+	{
+		if (initialized()) select_hot_path_3<debug, has_follow, true>();
+		else select_hot_path_3<debug, has_follow, false>();
+	}
+	template<bool debug> void select_hot_path_1()
+	{
+		if (follow) select_hot_path_2<debug, true>();
+		else select_hot_path_2<debug, false>();
+	}
+	void select_hot_path()
+	{
+		if (debug_level >= 1) select_hot_path_1<true>();
+		else select_hot_path_1<false>();
+	}
+	
+	template<bool debug, bool has_follow, bool known, bool stats, typename stat_t>
+	int lstat_hot(const char * fn_name, const char * path, stat_t* buf)
+	{
+		profiler::timer timer(profile);
+		if (stats) count_call(this->stats.interposed);
+		if (debug) DEBUG_VERBOSE("GitBSLR: %s(%s)\n", fn_name, path);
+		if (!known || is_in_git_dir(path))
+		{
+			if (debug) DEBUG("GitBSLR: %s(%s) - untouched because %s\n", fn_name, path, known ? "in .git" : ".git not yet located");
+			int ret = lstat_o_3264(in_base(path), buf);
+			int errno_tmp = errno;
+			if (ret >= 0) try_init(path);
+			errno = errno_tmp;
+			return ret;
+		}
+		
+		// a flush while stat runs means the result may be for something that's gone
+		unsigned attr_gen = (attr_ttl ? get_tree_gen() : 0);
+		bool attr_hit = (attr_ttl && attr_get(in_base(path), buf));
+		int ret = (attr_hit ? 0 : stat_3264(in_base(path), buf));
+		if (ret < 0)
+		{
+			if (debug) DEBUG("GitBSLR: %s(%s) - untouched because can't stat (%s)\n", fn_name, path, strerror(errno));
+			return lstat_o_3264(in_base(path), buf);
+		}
+		
+		uint64_t trace_start = (trace ? time_ns() : 0);
+		string newpath = resolve_symlink_t<has_follow>(path);
+		if (trace) trace_resolution(path, trace_start);
+		if (resolve_errno)
+		{
+			errno = resolve_errno;
+			resolve_errno = 0;
+			return -1;
+		}
+		// only now does the verdict tree know whether it's in the work tree
+		if (attr_ttl && !attr_hit && in_external_tree(path)) attr_put(in_base(path), buf, attr_gen);
+		if (profile) profile->charge(virtual_path(path), timer);
+		if (debug)
+		{
+			if (newpath) DEBUG("GitBSLR: %s(%s) -> %s\n", fn_name, path, newpath.c_str());
+			else DEBUG("GitBSLR: %s(%s) - not a link\n", fn_name, path);
+		}
+		if (newpath)
+		{
+			buf->st_mode &= ~S_IFMT;
+			buf->st_mode |= S_IFLNK;
+			buf->st_size = newpath.length();
+		}
+		// looking for the else clause to make it say 'no, it's not a link'? that's done by calling stat rather than lstat
+		return ret;
+	}
+	
+	template<bool debug, bool has_follow, bool known, bool stats>
+	ssize_t readlink_hot(const char * path, char * buf, size_t bufsiz)
+	{
+		profiler::timer timer(profile);
+		if (debug) DEBUG_VERBOSE("GitBSLR: readlink(%s)\n", path);
+		if (stats) count_call(this->stats.interposed);
+		if (!known || is_in_git_dir(path))
+		{
+			if (debug) DEBUG("GitBSLR: readlink(%s) - untouched because %s\n", path, known ? "in .git" : ".git not yet located");
+			count_fs_call(this->stats.readlink);
+			return readlink_o(in_base(path), buf, bufsiz);
+		}
+		
+		uint64_t trace_start = (trace ? time_ns() : 0);
+		string newpath = resolve_symlink_t<has_follow>(path);
+		if (trace) trace_resolution(path, trace_start);
+		if (resolve_errno)
+		{
+			errno = resolve_errno;
+			resolve_errno = 0;
+			return -1;
+		}
+		if (profile) profile->charge(virtual_path(path), timer);
+		if (debug) DEBUG("GitBSLR: readlink(%s) -> %s\n", path, newpath ? newpath.c_str() : "(not link)");
+		if (!newpath)
+		{
+			errno = EINVAL;
+			return -1;
+		}
+		
+		ssize_t nbytes = min(bufsiz, newpath.length());
+		memcpy(buf, (const char*)newpath, nbytes);
+		return nbytes;
+	}
+	
+public:
+	// Refuses to create links that point outside the work tree, or into .git.
+	int symlink(const char * target, const char * linkpath) const
+	{
+		if (!trace) return symlink_checked(target, linkpath);
+		uint64_t start = time_ns();
+		int ret = symlink_checked(target, linkpath);
+		int errno_tmp = errno;
+		trace->region("symlink", virtual_path(string(linkpath)) + " -> " + target, start);
+		errno = errno_tmp;
+		return ret;
+	}
+	
+private:
+	int symlink_checked(const char * target, const char * linkpath) const
+	{
+		DEBUG_VERBOSE("GitBSLR: symlink(%s <- %s)\n", target, linkpath);
+		
+		if (strstr(linkpath, "/.git/"))
+		{
+			// git init (and clone) create a symlink at some random filename in .git to 'testing', to check if that works. let it
+			return symlink_o(target, in_base(linkpath));
+		}
+		if ((string("/")+target+"/").contains("/.git/")) // make sure to reject all .git, not just current gitdir
+		{
+			fprintf(stderr, "GitBSLR: link at %s is not allowed to point to %s, since that's under .git/\n", linkpath, target);
+			errno = EPERM;
+			return -1;
+		}
+		if (!work_tree)
+		{
+			fprintf(stderr, "GitBSLR: cannot create symlinks before finding the work tree (this is a GitBSLR bug, please report it: "
+			                BUG_URL ")");
+			errno = EPERM;
+			return -1;
+		}
+		
+		if (linkpath[0] == '/')
+		{
+			fprintf(stderr, "GitBSLR: link at %s is not allowed to point to absolute path %s\n", linkpath, target);
+			errno = EPERM;
+			return -1;
+		}
+		
+		int n_leading_up = 0;
+		while (memcmp(target + n_leading_up*3, "../", 3) == 0)
+			n_leading_up++;
+		if ((string(target + n_leading_up*3)+"/").contains("/../"))
+		{
+			fprintf(stderr, "GitBSLR: link at %s is not allowed to point to %s; ../ components must be at the start\n", linkpath, target);
+			errno = EPERM;
+			return -1;
+		}
+		
+		// the work tree, and every symlink, is one-way; links may not point up past them
+		string linkpath_abs = realpath_d(in_base("."))+"/"+linkpath;
+		for (int i=0;i<=n_leading_up;i++)
+		{
+			linkpath_abs = dirname_d(linkpath_abs);
+			
+			struct stat buf;
+			if (lstat_o_3264(linkpath_abs, &buf) < 0)
+			{
+				int errno_tmp = errno;
+				fprintf(stderr, "GitBSLR: link at %s is not allowed to point to %s, since %s is inaccessible (%s)\n",
+				                linkpath, target, linkpath_abs.c_str(), strerror(errno_tmp));
+				errno = errno_tmp;
+				return -1;
+			}
+			if (S_ISLNK(buf.st_mode))
+			{
+				fprintf(stderr, "GitBSLR: link at %s is not allowed to point to %s, since %s is a symlink\n",
+				                linkpath, target, linkpath_abs.c_str());
+				errno = EPERM;
+				return -1;
+			}
+		}
+		
+		if (!(linkpath_abs+"/").startswith(work_tree))
+		{
+			fprintf(stderr, "GitBSLR: link at %s is not allowed to point to %s, since %s is not under %s\n",
+			                linkpath, target, linkpath_abs.c_str(), work_tree.c_str());
+			errno = EPERM;
+			return -1;
+		}
+		
+		DEBUG("GitBSLR: symlink(%s <- %s) - creating\n", target, linkpath);
+		return symlink_o(target, in_base(linkpath));
+	}
+};
+
+}
+using namespace gitbslr_internal;
+
+#endif
@@ -0,0 +1,80 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// GitBSLR is available under the same license as Git itself. If Git relicenses, you may choose
+//    whether to use GitBSLR under GPLv2 or Git's new license.
+
+#include "gitbslr.h"
+#include "libgitbslr.h"
+
+struct gitbslr_context {
+	path_handler gitpath;
+	gitbslr_context(const gitbslr_config& config) : gitpath(config) {}
+};
+
+gitbslr_context* gitbslr_open(const char * work_tree, const char * git_dir, const char * follow)
+{
+	if (!work_tree || work_tree[0] != '/')
+		return NULL;
+	
+	gitbslr_config config;
+	config.relative_to_work_tree = true;
+	// resolve_symlink compares realpaths against the work tree, so it must be a realpath too
+	config.work_tree = string::create_usurp(realpath(work_tree, NULL));
+	if (!config.work_tree)
+		return NULL;
+	config.git_dir = (git_dir ? string(git_dir) : path_handler::append_slash(config.work_tree) + ".git");
+	if (config.git_dir[0] != '/' || !path_handler::append_slash(config.git_dir).endswith("/.git/"))
+		return NULL;
+	if (path_handler::follow_error(follow))
+		return NULL;
+	config.follow = follow;
+	config.library = true;
+	
+	return new gitbslr_context(config);
+}
+
+enum path_check_t { chk_reject, chk_passthrough, chk_resolve };
+// Paths outside the work tree and Git directory are a bug in gitbslr.so, but just a wrong argument here.
+// Parents of the work tree are outside it too, but Git looks at them (in submodules, for example), and sees the truth.
+// If it's passed through, abs is set to the absolute path.
+static path_check_t check_path(gitbslr_context* ctx, const char * path, string& abs)
+{
+	const path_handler& gitpath = ctx->gitpath;
+	path_class_t cls = gitpath.classify(path, false);
+	if (cls == cls_unknown)
+	{
+		errno = EINVAL;
+		return chk_reject;
+	}
+	abs = path_handler::normalize_path(path[0] == '/' ? string(path) : gitpath.base_dir() + path);
+	if (cls == cls_work_tree && !path_handler::is_inside(gitpath.work_tree, abs))
+		return chk_passthrough;
+	return chk_resolve;
+}
+
+int gitbslr_lstat(gitbslr_context* ctx, const char * path, struct stat* buf)
+{
+	string abs;
+	path_check_t chk = check_path(ctx, path, abs);
+	if (chk == chk_reject) return -1;
+	if (chk == chk_passthrough) return lstat(abs, buf);
+	return ctx->gitpath.lstat("gitbslr_lstat", path, buf);
+}
+
+ssize_t gitbslr_readlink(gitbslr_context* ctx, const char * path, char * buf, size_t bufsiz)
+{
+	string abs;
+	path_check_t chk = check_path(ctx, path, abs);
+	if (chk == chk_reject) return -1;
+	if (chk == chk_passthrough) return readlink(abs, buf, bufsiz);
+	return ctx->gitpath.readlink(path, buf, bufsiz);
+}
+
+void gitbslr_flush(gitbslr_context* ctx)
+{
+	ctx->gitpath.flush();
+}
+
+void gitbslr_close(gitbslr_context* ctx)
+{
+	delete ctx;
+}
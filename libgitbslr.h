@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// GitBSLR is available under the same license as Git itself. If Git relicenses, you may choose
+//    whether to use GitBSLR under GPLv2 or Git's new license.
+
+// libgitbslr - GitBSLR without LD_PRELOAD, for long-running programs that want to see repositories the way Git does
+//  under GitBSLR. Open one context per repository and keep it around; it doesn't use the environment or the current
+//  directory, and can be used from several threads at once.
+// Link with -lgitbslr -ldl -lpthread -lstdc++ (or use a C++ compiler).
+
+#ifndef LIBGITBSLR_H
+#define LIBGITBSLR_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct gitbslr_context gitbslr_context;
+
+// work_tree must be an absolute path. git_dir may be NULL, meaning work_tree/.git; if not, it must end with .git.
+// follow is the same as GITBSLR_FOLLOW; NULL means no rules. Returns NULL if any of that is wrong.
+gitbslr_context* gitbslr_open(const char * work_tree, const char * git_dir, const char * follow);
+
+// Same as lstat and readlink, except they return what Git would see. Relative paths are relative to the work tree.
+// Paths outside the work tree and Git directory fail with EINVAL,
+// except the work tree's parents, which Git sees unchanged. If the work tree itself becomes inaccessible,
+// they fail with whatever errno that gave.
+int gitbslr_lstat(gitbslr_context* ctx, const char * path, struct stat* buf);
+ssize_t gitbslr_readlink(gitbslr_context* ctx, const char * path, char * buf, size_t bufsiz);
+
+// The context remembers what every directory and link resolved to. Call this after anything in the work tree,
+// or anything a link in it points to, is removed or renamed.
+void gitbslr_flush(gitbslr_context* ctx);
+
+void gitbslr_close(gitbslr_context* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
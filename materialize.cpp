@@ -0,0 +1,501 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// GitBSLR is available under the same license as Git itself. If Git relicenses, you may choose
+//    whether to use GitBSLR under GPLv2 or Git's new license.
+
+// gitbslr-materialize - builds a shadow work tree, containing what Git would see under GitBSLR, so Git can run there without GitBSLR.
+// gitbslr-materialize <shadow>
+//  Creates the shadow tree; it must not exist, or be an empty directory. Links Git would see as links are recreated,
+//   with the same target; everything else is copied, as a reflink if the filesystem supports that, otherwise a normal
+//   copy. (Not a hardlink; writing to either side would change the other.) Like 'git worktree add --detach', the shadow
+//   tree gets its own HEAD and index in the real Git directory's worktrees/, and a .git file pointing there; everything
+//   else is shared. That directory also gets a manifest of what every file looked like on both sides.
+// gitbslr-materialize --sync <shadow>
+//  Copies files that were modified or created in the shadow tree back to the real work tree, through any symlinks,
+//   so they end up wherever the link points. Files modified on both sides since the manifest was written are left
+//   alone, with a warning; the manifest is then updated. Deletions and new links are not synced.
+// Must be run in the real work tree; the Git directory and work tree are found the same way as in gitbslr-resolve.
+
+#include "gitbslr.h"
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+static int debug_level = 0;
+
+static path_handler* gitpath;
+
+static unsigned long n_dirs;
+static unsigned long n_links;
+static unsigned long n_reflinked;
+static unsigned long n_copied;
+static unsigned long n_synced;
+static unsigned long n_conflicts;
+static unsigned long n_skipped;
+
+// What a file looked like when it was last materialized or synced; a file is modified if any of this changed.
+struct file_state {
+	off_t size;
+	struct timespec mtime;
+	ino_t ino;
+	
+	file_state() : size(-1), ino(0) { mtime.tv_sec = 0; mtime.tv_nsec = 0; }
+	file_state(const struct stat& st) : size(st.st_size), mtime(st.st_mtim), ino(st.st_ino) {}
+	bool operator==(const file_state& other) const
+	{
+		return size == other.size && mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec &&
+		       ino == other.ino;
+	}
+	bool operator!=(const file_state& other) const { return !(*this == other); }
+};
+struct manifest_entry {
+	file_state real;
+	file_state shadow;
+};
+// Key is the virtual path.
+static strmap<manifest_entry> manifest;
+
+// The first line of the file, without the newline; blank if it can't be read.
+static string read_line(const string& path)
+{
+	FILE* f = fopen(path, "r");
+	if (!f) return "";
+	char * line = NULL;
+	size_t line_cap = 0;
+	ssize_t len = getline(&line, &line_cap, f);
+	fclose(f);
+	string ret;
+	if (len > 0) ret = string(line, line[len-1] == '\n' ? len-1 : len);
+	free(line);
+	return ret;
+}
+
+static void write_file(const string& path, const string& content)
+{
+	FILE* f = fopen(path, "w");
+	if (!f || fwrite(content.c_str(), 1, content.length(), f) != content.length() || fclose(f) != 0)
+		FATAL("gitbslr-materialize: can't create %s: %s\n", path.c_str(), strerror(errno));
+}
+
+// The shadow tree's own part of the Git directory, with trailing slash, as named by its .git file.
+static string admin_dir(const string& shadow)
+{
+	string line = read_line(shadow + ".git");
+	if (!line.startswith("gitdir: "))
+		FATAL("gitbslr-materialize: %s.git is missing, was the shadow tree made by gitbslr-materialize?\n", shadow.c_str());
+	return path_handler::append_slash(line.c_str() + strlen("gitdir: "));
+}
+
+// In the shadow tree's admin directory, so Git doesn't look at it, and several shadow trees can share a Git directory.
+static string manifest_path(const string& shadow)
+{
+	return admin_dir(shadow) + "gitbslr-materialize";
+}
+
+// One entry per file: the real side's size, mtime and inode, then the shadow side's, then the path, NUL-terminated.
+static void write_manifest(const string& path)
+{
+	string tmp = path + ".tmp";
+	FILE* f = fopen(tmp, "w");
+	if (!f)
+		FATAL("gitbslr-materialize: can't create %s: %s\n", tmp.c_str(), strerror(errno));
+	for (strmap<manifest_entry>::iterator it = manifest.begin(); it; ++it)
+	{
+		const file_state& r = it.value().real;
+		const file_state& s = it.value().shadow;
+		fprintf(f, "%lld %lld.%09ld %llu %lld %lld.%09ld %llu %s%c",
+		        (long long)r.size, (long long)r.mtime.tv_sec, (long)r.mtime.tv_nsec, (unsigned long long)r.ino,
+		        (long long)s.size, (long long)s.mtime.tv_sec, (long)s.mtime.tv_nsec, (unsigned long long)s.ino,
+		        it.key().c_str(), '\0');
+	}
+	if (fclose(f) != 0 || rename(tmp, path) < 0)
+		FATAL("gitbslr-materialize: can't write %s: %s\n", path.c_str(), strerror(errno));
+}
+
+static void read_manifest(const string& path)
+{
+	FILE* f = fopen(path, "r");
+	if (!f)
+		FATAL("gitbslr-materialize: can't read %s, was the shadow tree made by gitbslr-materialize?\n", path.c_str());
+	char * line = NULL;
+	size_t line_cap = 0;
+	while (getdelim(&line, &line_cap, '\0', f) > 0)
+	{
+		long long r_size, r_sec, s_size, s_sec;
+		long r_nsec, s_nsec;
+		unsigned long long r_ino, s_ino;
+		int pathpos;
+		if (sscanf(line, "%lld %lld.%ld %llu %lld %lld.%ld %llu %n",
+		           &r_size, &r_sec, &r_nsec, &r_ino, &s_size, &s_sec, &s_nsec, &s_ino, &pathpos) != 8)
+			FATAL("gitbslr-materialize: %s is corrupt\n", path.c_str());
+		manifest_entry& e = manifest[line+pathpos];
+		e.real.size = r_size;
+		e.real.mtime.tv_sec = r_sec;
+		e.real.mtime.tv_nsec = r_nsec;
+		e.real.ino = r_ino;
+		e.shadow.size = s_size;
+		e.shadow.mtime.tv_sec = s_sec;
+		e.shadow.mtime.tv_nsec = s_nsec;
+		e.shadow.ino = s_ino;
+	}
+	free(line);
+	fclose(f);
+}
+
+// Both sides of a file that was just materialized or synced.
+static void remember(const string& vpath, const string& shadow_path)
+{
+	struct stat real;
+	struct stat shadow;
+	if (gitpath->stat_3264(vpath, &real) < 0 || stat(shadow_path, &shadow) < 0)
+		FATAL("gitbslr-materialize: can't access %s: %s\n", vpath.c_str(), strerror(errno));
+	manifest_entry& e = manifest[vpath];
+	e.real = file_state(real);
+	e.shadow = file_state(shadow);
+}
+
+static string join(const string& dir, const char * name)
+{
+	if (!dir) return name;
+	return dir + "/" + name;
+}
+
+// Returns false for . and .., and for .git; Git doesn't look at the latter, neither in the work tree nor anywhere else.
+static bool want_entry(const char * name)
+{
+	return strcmp(name, ".") && strcmp(name, "..") && strcmp(name, ".git");
+}
+
+static bool copy_contents(int src, int dst)
+{
+	// copy_file_range does server-side copies on NFS and similar, and reflinks on some filesystems where FICLONE is unsupported
+	while (true)
+	{
+		ssize_t n = copy_file_range(src, NULL, dst, NULL, 1024*1024*1024, 0);
+		if (n == 0) return true;
+		if (n < 0) break;
+	}
+	if (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP)
+		return false;
+	
+	char buf[65536];
+	while (true)
+	{
+		ssize_t n = read(src, buf, sizeof(buf));
+		if (n == 0) return true;
+		if (n < 0) return false;
+		if (write(dst, buf, n) != n) return false;
+	}
+}
+
+static void copy_times(int fd, const struct stat& st)
+{
+	struct timespec times[2] = { st.st_atim, st.st_mtim };
+	futimens(fd, times);
+}
+
+// Creates dst as a clone of src, with the same permissions and timestamps.
+static void clone_file(const string& src, const string& dst, const struct stat& st)
+{
+	int fd_src = open(src, O_RDONLY);
+	if (fd_src < 0)
+		FATAL("gitbslr-materialize: can't read %s: %s\n", src.c_str(), strerror(errno));
+	int fd_dst = open(dst, O_WRONLY|O_CREAT|O_EXCL, st.st_mode & 07777);
+	if (fd_dst < 0)
+		FATAL("gitbslr-materialize: can't create %s: %s\n", dst.c_str(), strerror(errno));
+
+#ifdef FICLONE
+	if (ioctl(fd_dst, FICLONE, fd_src) == 0)
+	{
+		n_reflinked++;
+		copy_times(fd_dst, st);
+		close(fd_dst);
+		close(fd_src);
+		return;
+	}
+#endif
+	
+	if (!copy_contents(fd_src, fd_dst))
+		FATAL("gitbslr-materialize: can't copy %s to %s: %s\n", src.c_str(), dst.c_str(), strerror(errno));
+	n_copied++;
+	copy_times(fd_dst, st);
+	close(fd_dst);
+	close(fd_src);
+}
+
+// vdir is a virtual path, blank for the work tree root. The current directory is the work tree.
+static void materialize(const string& vdir, const string& shadow)
+{
+	DIR* dir = opendir(vdir ? vdir.c_str() : ".");
+	if (!dir)
+		FATAL("gitbslr-materialize: can't read %s: %s\n", vdir.c_str(), strerror(errno));
+	
+	while (true)
+	{
+		dirent* ent = readdir(dir);
+		if (!ent) break;
+		if (!want_entry(ent->d_name)) continue;
+		
+		string vpath = join(vdir, ent->d_name);
+		string dst = shadow + vpath;
+		
+		struct stat st;
+		if (gitpath->stat_3264(vpath, &st) < 0)
+		{
+			// broken link; Git sees it as is
+			string target = gitpath->readlink_d(vpath);
+			if (!target || symlink(target, dst) < 0)
+				FATAL("gitbslr-materialize: can't copy link %s: %s\n", vpath.c_str(), strerror(errno));
+			n_links++;
+			continue;
+		}
+		
+		string target = gitpath->resolve_symlink(vpath);
+		if (target)
+		{
+			DEBUG("gitbslr-materialize: %s -> %s\n", vpath.c_str(), target.c_str());
+			if (symlink(target, dst) < 0)
+				FATAL("gitbslr-materialize: can't create link %s: %s\n", dst.c_str(), strerror(errno));
+			n_links++;
+		}
+		else if (S_ISDIR(st.st_mode))
+		{
+			if (mkdir(dst, st.st_mode & 07777) < 0)
+				FATAL("gitbslr-materialize: can't create %s: %s\n", dst.c_str(), strerror(errno));
+			n_dirs++;
+			materialize(vpath, shadow);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			clone_file(vpath, dst, st);
+			remember(vpath, dst);
+		}
+		else
+		{
+			fprintf(stderr, "gitbslr-materialize: skipping %s, it's not a file, directory or link\n", vpath.c_str());
+			n_skipped++;
+		}
+	}
+	closedir(dir);
+}
+
+// Copies shadow file src over the real file dst, in place, so it ends up in whatever file dst's links point to.
+static void sync_file(const string& src, const string& dst, const struct stat& st)
+{
+	int fd_src = open(src, O_RDONLY);
+	if (fd_src < 0)
+		FATAL("gitbslr-materialize: can't read %s: %s\n", src.c_str(), strerror(errno));
+	int fd_dst = open(dst, O_WRONLY|O_CREAT|O_TRUNC, st.st_mode & 07777);
+	if (fd_dst < 0)
+		FATAL("gitbslr-materialize: can't write %s: %s\n", dst.c_str(), strerror(errno));
+	if (!copy_contents(fd_src, fd_dst))
+		FATAL("gitbslr-materialize: can't copy %s to %s: %s\n", src.c_str(), dst.c_str(), strerror(errno));
+	fchmod(fd_dst, st.st_mode & 07777);
+	// same timestamp on both sides, so the next sync knows they're identical
+	copy_times(fd_dst, st);
+	close(fd_dst);
+	close(fd_src);
+	n_synced++;
+}
+
+// vdir is a virtual path, blank for the root; the current directory is the work tree.
+static void sync(const string& vdir, const string& shadow)
+{
+	string shadow_dir = shadow + vdir;
+	DIR* dir = opendir(shadow_dir);
+	if (!dir)
+		FATAL("gitbslr-materialize: can't read %s: %s\n", shadow_dir.c_str(), strerror(errno));
+	
+	while (true)
+	{
+		dirent* ent = readdir(dir);
+		if (!ent) break;
+		if (!want_entry(ent->d_name)) continue;
+		
+		string vpath = join(vdir, ent->d_name);
+		string src = shadow + vpath;
+		
+		struct stat st;
+		if (lstat(src, &st) < 0)
+			FATAL("gitbslr-materialize: can't access %s: %s\n", src.c_str(), strerror(errno));
+		
+		struct stat real;
+		bool exists = (gitpath->stat_3264(vpath, &real) == 0);
+		
+		if (S_ISDIR(st.st_mode))
+		{
+			if (!exists && mkdir(vpath, st.st_mode & 07777) < 0)
+				FATAL("gitbslr-materialize: can't create %s: %s\n", vpath.c_str(), strerror(errno));
+			sync(vpath, shadow);
+		}
+		else if (S_ISREG(st.st_mode))
+		{
+			// compare both sides to how they were at the last materialize or sync, not to each other;
+			// either side's mtime can be anything, and the real side may have been changed too
+			manifest_entry* known = manifest.get(vpath);
+			if (known && file_state(st) == known->shadow)
+				continue;
+			if (known ? (!exists || file_state(real) != known->real) : exists)
+			{
+				fprintf(stderr, "gitbslr-materialize: %s was %s on both sides, not syncing it\n",
+				        vpath.c_str(), known ? "modified" : "created");
+				n_conflicts++;
+				continue;
+			}
+			DEBUG("gitbslr-materialize: syncing %s\n", vpath.c_str());
+			sync_file(src, vpath, st);
+			remember(vpath, src);
+		}
+	}
+	closedir(dir);
+}
+
+// The commit the real work tree has checked out, from 'git rev-parse'; blank if none, for example in a new repository.
+static string head_commit(const string& git_dir)
+{
+	int fds[2];
+	if (pipe(fds) < 0)
+		return "";
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		dup2(fds[1], 1);
+		close(fds[0]);
+		close(fds[1]);
+		string arg = string("--git-dir=") + git_dir;
+		execlp("git", "git", arg.c_str(), "rev-parse", "--verify", "-q", "HEAD^{commit}", (char*)NULL);
+		_exit(127);
+	}
+	close(fds[1]);
+	char buf[128];
+	ssize_t len = (pid < 0 ? -1 : read(fds[0], buf, sizeof(buf)-1));
+	close(fds[0]);
+	int status = -1;
+	if (pid > 0) waitpid(pid, &status, 0);
+	if (len <= 0 || status != 0)
+		return "";
+	while (len && buf[len-1] == '\n') len--;
+	return string(buf, len);
+}
+
+// Same as 'git worktree add --detach': the shadow tree gets its own HEAD and index, in <common dir>/worktrees/<name>/,
+// so checking out or refreshing the index there doesn't touch the real work tree's. Objects, refs and config are shared.
+static void create_admin_dir(const string& shadow)
+{
+	string git_dir = string(gitpath->git_dir.c_str(), gitpath->git_dir.length()-1);
+	// if the real work tree is itself a linked worktree, the new one goes next to it, in the main Git directory
+	string common = read_line(gitpath->git_dir + "commondir");
+	if (!common) common = git_dir;
+	else if (common[0] != '/') common = gitpath->git_dir + common;
+	
+	string worktrees = common + "/worktrees";
+	if (mkdir(worktrees, 0777) < 0 && errno != EEXIST)
+		FATAL("gitbslr-materialize: can't create %s: %s\n", worktrees.c_str(), strerror(errno));
+	
+	// named after the shadow tree; like Git, add a number if that's taken
+	string parent = path_handler::parent_dir(shadow);
+	string base = string(shadow.c_str() + parent.length() + 1, shadow.length() - parent.length() - 2);
+	string admin;
+	for (int i=0;;i++)
+	{
+		char suffix[16] = "";
+		if (i) sprintf(suffix, "%d", i);
+		admin = worktrees + "/" + base + (const char*)suffix;
+		if (mkdir(admin, 0777) == 0) break;
+		if (errno != EEXIST)
+			FATAL("gitbslr-materialize: can't create %s: %s\n", admin.c_str(), strerror(errno));
+	}
+	admin += "/";
+	
+	write_file(admin + "gitdir", shadow + ".git\n");
+	write_file(admin + "commondir", common + "\n");
+	// detached, since a branch can only be checked out in one work tree; if there's no commit yet, same unborn branch
+	string head = head_commit(git_dir);
+	if (!head) head = read_line(gitpath->git_dir + "HEAD");
+	write_file(admin + "HEAD", head + "\n");
+	// a copy of the real index, so whatever is staged there is staged here too
+	int fd_src = open(gitpath->git_dir + "index", O_RDONLY);
+	if (fd_src >= 0)
+	{
+		int fd_dst = open(admin + "index", O_WRONLY|O_CREAT|O_EXCL, 0666);
+		if (fd_dst < 0 || !copy_contents(fd_src, fd_dst))
+			FATAL("gitbslr-materialize: can't copy the index to %s: %s\n", admin.c_str(), strerror(errno));
+		close(fd_dst);
+		close(fd_src);
+	}
+	write_file(shadow + ".git", string("gitdir: ") + admin + "\n");
+}
+
+static void usage()
+{
+	FATAL("usage: gitbslr-materialize [--sync] <shadow>\n");
+}
+
+int main(int argc, char** argv)
+{
+	bool do_sync = false;
+	const char * shadow_arg = NULL;
+	for (int i=1;i<argc;i++)
+	{
+		if (!strcmp(argv[i], "--sync"))
+			do_sync = true;
+		else if (!shadow_arg && argv[i][0] != '-')
+			shadow_arg = argv[i];
+		else
+			usage();
+	}
+	if (!shadow_arg)
+		usage();
+	
+	gitbslr_config config = gitbslr_config::from_env();
+	debug_level = config.debug_level;
+	config.profile = false;
+	config.find_repo();
+	
+	static path_handler handler(config);
+	gitpath = &handler;
+	
+	if (!do_sync && mkdir(shadow_arg, 0777) < 0 && errno != EEXIST)
+		FATAL("gitbslr-materialize: can't create %s: %s\n", shadow_arg, strerror(errno));
+	string shadow = string::create_usurp(realpath(shadow_arg, NULL));
+	if (!shadow)
+		FATAL("gitbslr-materialize: can't access %s: %s\n", shadow_arg, strerror(errno));
+	shadow += "/";
+	if (path_handler::is_inside(gitpath->work_tree, shadow) || path_handler::is_inside(shadow, gitpath->work_tree))
+		FATAL("gitbslr-materialize: shadow tree %s can't overlap the work tree %s\n", shadow.c_str(), gitpath->work_tree.c_str());
+	
+	if (chdir(gitpath->work_tree) < 0)
+		FATAL("gitbslr-materialize: can't enter work tree %s: %s\n", gitpath->work_tree.c_str(), strerror(errno));
+	
+	if (do_sync)
+	{
+		string manifest_file = manifest_path(shadow);
+		read_manifest(manifest_file);
+		sync("", shadow);
+		write_manifest(manifest_file);
+		printf("gitbslr-materialize: %lu files synced, %lu modified on both sides\n", n_synced, n_conflicts);
+		return n_conflicts ? 1 : 0;
+	}
+	
+	DIR* dir = opendir(shadow);
+	if (!dir)
+		FATAL("gitbslr-materialize: can't read %s: %s\n", shadow.c_str(), strerror(errno));
+	while (true)
+	{
+		dirent* ent = readdir(dir);
+		if (!ent) break;
+		if (strcmp(ent->d_name, ".") && strcmp(ent->d_name, ".."))
+			FATAL("gitbslr-materialize: %s is not empty\n", shadow.c_str());
+	}
+	closedir(dir);
+	
+	create_admin_dir(shadow);
+	materialize("", shadow);
+	write_manifest(manifest_path(shadow));
+	
+	printf("gitbslr-materialize: %lu directories, %lu links, %lu reflinked, %lu copied, %lu skipped\n",
+	       n_dirs, n_links, n_reflinked, n_copied, n_skipped);
+	return 0;
+}
@@ -0,0 +1,240 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// GitBSLR is available under the same license as Git itself. If Git relicenses, you may choose
+//    whether to use GitBSLR under GPLv2 or Git's new license.
+
+// gitbslr-resolve - tells what Git would see under GitBSLR, without running Git.
+// Reads virtual paths from stdin, one per line (or NUL-terminated with -z), and prints one line per path:
+//  link<TAB>path<TAB>target - Git sees a symlink, pointing to target
+//  inline<TAB>path          - it's a symlink, but Git sees the file or directory it points to
+//  dir<TAB>path             - a directory
+//  file<TAB>path            - a file, or anything else that's not a directory or link
+//  broken<TAB>path          - a symlink to a nonexistent target
+//  missing<TAB>path         - nonexistent
+//  outside<TAB>path         - not in the work tree or Git directory
+// With -z, output lines are NUL-terminated too. Output is in the same order as input, and is written as soon as
+//  there's no more input ready, so it can be used as a coprocess, one path at a time.
+// The Git directory and work tree are found the same way Git does it, or from GITBSLR_GIT_DIR and GITBSLR_WORK_TREE;
+//  GITBSLR_FOLLOW, GITBSLR_DEBUG, GITBSLR_VERIFY, GITBSLR_PREFETCH and GITBSLR_STATS work the same way as in gitbslr.so.
+
+#include "gitbslr.h"
+#include <pthread.h>
+#include <poll.h>
+
+// Paths are handed out in batches, so the output can be written in order without waiting for the entire input.
+// A batch ends early if the next path isn't available yet; the client may be waiting for the answers first.
+static const size_t batch_size = 4096;
+
+static int debug_level = 0;
+
+// Same object for the entire run, so whatever it has figured out about the work tree is reused for every path.
+static path_handler* gitpath;
+
+static string resolve_path(const string& path)
+{
+	if (gitpath->classify(path, false) == cls_unknown)
+		return string("outside\t") + path;
+	
+	struct stat st;
+	if (gitpath->stat_3264(path, &st) < 0)
+	{
+		if (gitpath->lstat_o_3264(path, &st) < 0)
+			return string("missing\t") + path;
+		return string("broken\t") + path;
+	}
+	
+	string target = gitpath->resolve_symlink(path);
+	if (target)
+		return string("link\t") + path + "\t" + target;
+	
+	struct stat lst;
+	if (gitpath->lstat_o_3264(path, &lst) == 0 && S_ISLNK(lst.st_mode))
+		return string("inline\t") + path;
+	if (S_ISDIR(st.st_mode))
+		return string("dir\t") + path;
+	return string("file\t") + path;
+}
+
+struct batch {
+	string paths[batch_size];
+	string results[batch_size];
+	size_t count;
+	size_t next;
+};
+
+static void* worker(void* userdata)
+{
+	batch* b = (batch*)userdata;
+	while (true)
+	{
+		size_t i = __sync_fetch_and_add(&b->next, 1);
+		if (i >= b->count)
+			return NULL;
+		b->results[i] = resolve_path(b->paths[i]);
+	}
+}
+
+// Like getdelim, except it can tell whether the next line is available without waiting for it.
+class line_reader {
+	int fd;
+	char sep;
+	char * buf;
+	size_t start;
+	size_t end;
+	size_t cap;
+	bool eof;
+	
+	void fill()
+	{
+		if (start)
+		{
+			memmove(buf, buf+start, end-start);
+			end -= start;
+			start = 0;
+		}
+		if (end == cap)
+		{
+			cap *= 2;
+			buf = realloc(buf, cap);
+		}
+		ssize_t n;
+		do {
+			n = read(fd, buf+end, cap-end);
+		} while (n < 0 && errno == EINTR);
+		if (n <= 0) eof = true;
+		else end += n;
+	}
+	
+public:
+	line_reader(int fd, char sep) : fd(fd), sep(sep), start(0), end(0), cap(65536), eof(false) { buf = malloc(cap); }
+	~line_reader() { free(buf); }
+	
+	// Returns whether next() would return without blocking.
+	bool ready() const
+	{
+		if (eof || memchr(buf+start, sep, end-start)) return true;
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		return poll(&pfd, 1, 0) > 0;
+	}
+	
+	// Returns the next line, without the separator. Returns false at the end of the input.
+	bool next(string& line)
+	{
+		while (true)
+		{
+			char * found = (char*)memchr(buf+start, sep, end-start);
+			if (found)
+			{
+				line = string(buf+start, found-(buf+start));
+				start = found+1-buf;
+				return true;
+			}
+			if (eof)
+			{
+				// last line, without separator
+				if (start == end) return false;
+				line = string(buf+start, end-start);
+				start = end;
+				return true;
+			}
+			fill();
+		}
+	}
+};
+
+static void usage()
+{
+	FATAL("usage: gitbslr-resolve [-z] [-j threads] < paths\n");
+}
+
+int main(int argc, char** argv)
+{
+	char sep = '\n';
+	long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int i=1;i<argc;i++)
+	{
+		const char * arg = argv[i];
+		if (!strcmp(arg, "-z"))
+			sep = '\0';
+		else if (!strncmp(arg, "-j", 2))
+		{
+			const char * num = arg[2] ? arg+2 : argv[++i];
+			if (!num) usage();
+			char * end;
+			n_threads = strtol(num, &end, 10);
+			if (*end || n_threads <= 0) usage();
+		}
+		else
+			usage();
+	}
+	if (n_threads <= 0) n_threads = 1;
+	
+	gitbslr_config config = gitbslr_config::from_env();
+	debug_level = config.debug_level;
+	// the profiler charges resolutions from the interposed functions, which this doesn't use
+	config.profile = false;
+	
+	config.find_repo();
+	
+	static path_handler handler(config);
+	gitpath = &handler;
+	
+	// like Git, resolve everything relative to the work tree root
+	if (chdir(gitpath->work_tree) < 0)
+		FATAL("gitbslr-resolve: can't enter work tree %s: %s\n", gitpath->work_tree.c_str(), strerror(errno));
+	
+	pthread_t* threads = malloc(sizeof(pthread_t) * n_threads);
+	batch* b = new batch();
+	line_reader input(0, sep);
+	string line;
+	bool eof = false;
+	while (!eof)
+	{
+		b->count = 0;
+		b->next = 0;
+		while (b->count < batch_size)
+		{
+			if (b->count && !input.ready())
+				break;
+			if (!input.next(line))
+			{
+				eof = true;
+				break;
+			}
+			if (!line) continue;
+			b->paths[b->count++] = line;
+		}
+		
+		// no point starting threads for the last few paths
+		long n_started = min(n_threads, (long)b->count) - 1;
+		for (long i=0;i<n_started;i++)
+		{
+			if (pthread_create(&threads[i], NULL, worker, b) != 0)
+				FATAL("gitbslr-resolve: couldn't create thread\n");
+		}
+		worker(b);
+		for (long i=0;i<n_started;i++)
+			pthread_join(threads[i], NULL);
+		
+		for (size_t i=0;i<b->count;i++)
+		{
+			fwrite(b->results[i].c_str(), 1, b->results[i].length(), stdout);
+			putchar(sep);
+		}
+		fflush(stdout);
+	}
+	
+	delete b;
+	free(threads);
+	if (fflush(stdout) != 0 || ferror(stdout))
+		FATAL("gitbslr-resolve: write error\n");
+	
+	const char * stats_path = getenv("GITBSLR_STATS");
+	if (stats_path && *stats_path)
+	{
+		gitpath->stop_prefetch();
+		FILE* f = (stats_path[0] == '/' ? fopen(stats_path, "a") : NULL);
+		gitpath->stats.print(f ? f : stderr);
+		if (f) fclose(f);
+	}
+	return 0;
+}
@@ -0,0 +1,82 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests gitbslr-materialize, which creates a shadow tree that plain Git can use.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+echo test >                     test/repo/dir/file
+echo test >                     test/repo/dir/both
+ln_sr test/repo/dir/file        test/repo/to_file
+mkdir                           test/outside/
+echo test >                     test/outside/file
+ln_sr test/repo/                test/outside/to_repo
+ln_sr test/outside/             test/repo/to_outside
+
+echo ' -> '                  >> test/expected.log
+echo 'dir -> '               >> test/expected.log
+echo 'dir/both -> '          >> test/expected.log
+echo 'dir/file -> '          >> test/expected.log
+echo 'to_file -> dir/file'   >> test/expected.log
+echo 'to_outside -> '        >> test/expected.log
+echo 'to_outside/file -> '   >> test/expected.log
+echo 'to_outside/to_repo -> ..' >> test/expected.log
+
+cd test/repo/
+git init
+gitbslr add .
+gitbslr commit -m "GitBSLR test"
+../../gitbslr-materialize ../shadow
+cd ../../
+tree test/shadow/ > test/output.log
+diff -U999 test/output.log test/expected.log
+
+#the shadow tree is a snapshot, even if the files are written in place
+echo changed in place >> test/repo/dir/file
+[ "$(cat test/shadow/dir/file)" = test ] || exit 1
+
+#the shadow tree has its own HEAD and index; Git there must not touch the real ones
+HEAD_REF=$(git -C test/repo/ symbolic-ref HEAD)
+INDEX=$(cksum < test/repo/.git/index)
+cd test/shadow/
+[ -z "$(git status --porcelain)" ] || exit 1
+git checkout -q -b shadow_branch
+git -C ../repo/ worktree list | grep shadow_branch
+cd ../../
+[ "$(git -C test/repo/ symbolic-ref HEAD)" = "$HEAD_REF" ] || exit 1
+[ "$(cksum < test/repo/.git/index)" = "$INDEX" ] || exit 1
+
+cd test/shadow/
+echo changed > to_outside/file
+echo new > dir/new
+cd ../repo/
+#dir/file was only changed on the real side, so it's left alone, and it's no conflict
+../../gitbslr-materialize --sync ../shadow
+cd ../../
+
+[ "$(cat test/outside/file)" = changed ] || exit 1
+[ "$(cat test/repo/dir/new)" = new ] || exit 1
+[ "$(tail -n1 test/repo/dir/file)" = "changed in place" ] || exit 1
+[ -L test/repo/to_outside ] || exit 1
+
+#modified on both sides, the shadow tree last; the real side's change must survive, whichever mtime is newer
+echo real > test/repo/dir/both
+sleep 0.1
+echo shadow > test/shadow/dir/both
+#and a file synced before must not be synced again if only the real side changed since
+echo changed again > test/outside/file
+cd test/repo/
+../../gitbslr-materialize --sync ../shadow > ../sync.log 2>&1 && exit 1
+cat ../sync.log
+grep 'dir/both was modified on both sides' ../sync.log
+grep to_outside ../sync.log && exit 1
+grep '0 files synced, 1 modified on both sides' ../sync.log
+cd ../../
+[ "$(cat test/repo/dir/both)" = real ] || exit 1
+[ "$(cat test/outside/file)" = "changed again" ] || exit 1
+
+echo Test passed
@@ -0,0 +1,111 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests that GitBSLR notices when Git replaces directories and links it has already resolved.
+#GITBSLR_VERIFY catches any stale answer.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+echo test >                     test/repo/dir/file
+ln_sr test/repo/dir/            test/repo/sub
+mkdir                           test/outside/
+echo test >                     test/outside/file
+ln_sr test/outside/             test/repo/ext
+
+cd test/repo/
+git init
+gitbslr add .
+gitbslr commit -m "GitBSLR test 1"
+
+rm sub
+mkdir sub
+echo sub > sub/file
+rm ext
+ln_sr dir/ ext
+gitbslr add -A .
+gitbslr commit -m "GitBSLR test 2"
+
+gitbslr checkout HEAD~1
+[ -L sub ] || exit 1
+[ -z "$(gitbslr status --porcelain)" ] || exit 1
+gitbslr checkout -
+[ -d sub ] && [ ! -L sub ] || exit 1
+[ -z "$(gitbslr status --porcelain)" ] || exit 1
+
+#each checkout resolves everything, then removes and replaces things, then looks at the new ones; GitBSLR only forgets
+# what those removals could have changed, which has to include other aliases of the same thing, and links through it
+mkdir                           ../outside/dir/
+echo test >                     ../outside/dir/file
+echo test >                     ../outside/dir/file2
+ln_sr ../outside/               out1
+ln_sr ../outside/               out2
+ln_sr sub/file                  to_sub_file
+ln_sr dir/                      to_dir
+ln -s to_dir/file                to_file_via_link
+gitbslr add -A .
+gitbslr commit -m "GitBSLR test 3"
+gitbslr rm -q out1/dir/file
+rm to_sub_file
+ln_sr dir/file                  to_sub_file
+rm to_dir
+mkdir                           to_dir/
+echo test >                     to_dir/file
+rm -r sub
+ln_sr dir/                      sub
+gitbslr add -A .
+gitbslr commit -m "GitBSLR test 4"
+[ ! -e out2/dir/file ] || exit 1
+
+gitbslr checkout HEAD~1
+[ -e out2/dir/file ] && [ -L to_dir ] && [ -d sub ] && [ ! -L sub ] || exit 1
+[ -z "$(gitbslr status --porcelain)" ] || exit 1
+gitbslr checkout -
+[ ! -e out2/dir/file ] && [ ! -L to_dir ] && [ -L sub ] || exit 1
+[ -z "$(gitbslr status --porcelain)" ] || exit 1
+cd ../../
+
+#the same, one call at a time; removing a file only affects links to it, but removing or replacing a link affects
+# every link whose target goes through it
+mkdir                           test/repo2/
+mkdir                           test/repo2/dir/
+echo test >                     test/repo2/dir/file
+echo test >                     test/repo2/dir/gone
+ln_sr test/repo2/dir/           test/repo2/via
+ln -s via/file                  test/repo2/to_file
+ln_sr test/repo2/dir/gone       test/repo2/to_gone
+ln_sr test/outside/             test/repo2/via2
+git init test/repo2/
+
+cat > test/invalidate.c <<'EOT'
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CHECK(x) do { if (!(x)) { printf("failed: %s\n", #x); exit(1); } } while(0)
+
+int main(void)
+{
+	struct stat st;
+	char buf[64];
+	CHECK(readlink("to_gone", buf, sizeof(buf)) == 8);
+	CHECK(unlink("dir/gone") == 0);
+	CHECK(readlink("to_gone", buf, sizeof(buf)) == -1);
+	
+	CHECK(lstat("to_file", &st) == 0 && S_ISLNK(st.st_mode));
+	CHECK(rename("via2", "via") == 0);
+	CHECK(lstat("to_file", &st) == 0 && S_ISREG(st.st_mode));
+	printf("invalidation works\n");
+	return 0;
+}
+EOT
+cc test/invalidate.c -o test/invalidate
+cd test/repo2/
+LD_PRELOAD=$GITBSLR GITBSLR_GIT_DIR=$(pwd)/.git GITBSLR_WORK_TREE=$(pwd) ../invalidate | grep 'invalidation works'
+cd ../../
+
+echo Test passed
@@ -0,0 +1,52 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests GITBSLR_PREFETCH, which resolves everything in the index in a background thread.
+#GITBSLR_VERIFY checks that whatever it found is right; this checks that it reads all index formats.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+mkdir                           test/repo/dir/subdir/
+echo test >                     test/repo/dir/file
+echo test >                     test/repo/dir/subdir/file
+ln_sr test/repo/dir/file        test/repo/to_file
+mkdir                           test/outside/
+echo test >                     test/outside/file1
+echo test >                     test/outside/file2
+ln_sr test/outside/             test/repo/to_outside
+
+export GITBSLR_PREFETCH=1
+
+cd test/repo/
+git init
+gitbslr add .
+gitbslr commit -m "GitBSLR test"
+for version in 2 3 4; do
+  git update-index --index-version $version
+  [ -z "$(gitbslr status --porcelain)" ] || exit 1
+  #gitbslr-resolve waits for stdin, so the prefetch thread has time to finish
+  [ "$(sleep 1 | ../../gitbslr-resolve 2>&1 | grep prefetched)" = "GitBSLR: prefetched 5 of 5 paths" ] || exit 1
+done
+
+#and the lookups after that must find everything already resolved
+#usage: own_calls
+#resolves everything in the index, after giving the prefetch thread time to do it first, and prints how many
+# filesystem calls that took, not counting the prefetch thread
+own_calls()
+{
+  (sleep 1; git ls-files) | with_stats ../../gitbslr-resolve > /dev/null 2>&1
+  echo $(($(fs_calls) - $(stats_sum prefetch)))
+}
+#the reference implementation would be counted too
+export GITBSLR_VERIFY=0
+WITH=$(own_calls)
+WITHOUT=$(GITBSLR_PREFETCH=0 own_calls)
+echo "$WITH filesystem calls with prefetching, $WITHOUT without"
+[ $WITH -lt $WITHOUT ] || exit 1
+cd ../../
+
+echo Test passed
@@ -0,0 +1,116 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests GITBSLR_INHERIT, which passes GitBSLR and its cache on to Git's Git children, but not to anything else.
+#They log what they change, so the parent only forgets that; after anything else, it forgets everything.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+echo test >                     test/repo/dir/file
+ln_sr test/repo/dir/file        test/repo/to_file
+mkdir                           test/outside/
+echo test >                     test/outside/file
+ln_sr test/outside/             test/repo/to_outside
+
+export GITBSLR_INHERIT=1
+
+cd test/repo/
+git init
+gitbslr add .
+#git commit runs 'git maintenance run --auto' afterwards
+gitbslr commit -m "GitBSLR test" 2> ../commit.log
+grep 'Inherited [1-9][0-9]* directories and [1-9][0-9]* verdicts' ../commit.log
+git log --oneline | grep 'GitBSLR test'
+#the editor doesn't get GitBSLR, and once it exits, there's nothing left to inherit; it may have changed anything
+echo test >                     dir/file3
+gitbslr add dir/file3
+EDITOR='env > ../editor_env.log; echo "GitBSLR test 3" >' gitbslr commit 2> ../commit.log
+grep 'Inherited [1-9][0-9]* directories' ../commit.log && exit 1
+[ -s ../editor_env.log ] || exit 1
+grep LD_PRELOAD ../editor_env.log && exit 1
+git log --oneline | grep 'GitBSLR test 3'
+[ -z "$(gitbslr status --porcelain)" ] || exit 1
+#the inherited cache is a snapshot; once a child changes the work tree, the parent must forget what it knew
+echo test2 >                    dir/file2
+gitbslr add dir/file2
+gitbslr commit -m "GitBSLR test 2"
+gitbslr rebase --exec 'rm to_file && ln -s dir/file2 to_file' HEAD~1 2> ../rebase.log || true
+grep 'GitBSLR bug' ../rebase.log && exit 1
+[ "$(gitbslr status --porcelain)" = " M to_file" ] || exit 1
+#a Git child's removals and renames are logged, so the parent only forgets those
+gitbslr stash 2> ../stash.log
+grep 'GitBSLR bug' ../stash.log && exit 1
+grep 'exited, forgetting what it changed' ../stash.log
+grep 'exited, forgetting everything' ../stash.log && exit 1
+[ -z "$(gitbslr status --porcelain)" ] || exit 1
+gitbslr stash pop 2> ../stash.log
+grep 'GitBSLR bug' ../stash.log && exit 1
+[ "$(gitbslr status --porcelain)" = " M to_file" ] || exit 1
+cd ../../
+
+#the same, one call at a time; a Git child removes and renames links, and the parent must see that
+mkdir                           test/repo2/
+mkdir                           test/repo2/dir/
+echo test >                     test/repo2/dir/file
+echo test >                     test/repo2/dir/gone
+ln_sr test/repo2/dir/           test/repo2/via
+ln -s via/file                  test/repo2/to_file
+ln_sr test/repo2/dir/gone       test/repo2/to_gone
+ln_sr test/outside/             test/repo2/via2
+git init test/repo2/
+
+cat > test/git-inherit.c <<'EOT'
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CHECK(x) do { if (!(x)) { printf("failed: %s\n", #x); exit(1); } } while(0)
+
+extern char ** environ;
+
+int main(int argc, char ** argv)
+{
+	struct stat st;
+	char buf[64];
+	if (argc > 1)
+	{
+		// GitBSLR shows links to outside the work tree as directories
+		CHECK(readlink("via2", buf, sizeof(buf)) == -1);
+		CHECK(unlink("dir/gone") == 0);
+		CHECK(rename("via2", "via") == 0);
+		return 0;
+	}
+	
+	CHECK(readlink("to_gone", buf, sizeof(buf)) == 8);
+	CHECK(lstat("to_file", &st) == 0 && S_ISLNK(st.st_mode));
+	
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		char * child_argv[] = { argv[0], (char*)"child", NULL };
+		execve(argv[0], child_argv, environ);
+		_exit(1);
+	}
+	int status;
+	CHECK(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	
+	CHECK(readlink("to_gone", buf, sizeof(buf)) == -1);
+	CHECK(lstat("to_file", &st) == 0 && S_ISREG(st.st_mode));
+	printf("inherited invalidation works\n");
+	return 0;
+}
+EOT
+cc test/git-inherit.c -o test/git-inherit
+cd test/repo2/
+LD_PRELOAD=$GITBSLR GITBSLR_GIT_DIR=$(pwd)/.git GITBSLR_WORK_TREE=$(pwd) $(pwd)/../git-inherit 2> ../inherit.log | grep 'inherited invalidation works'
+grep 'exited, forgetting what it changed' ../inherit.log
+cd ../../
+
+echo Test passed
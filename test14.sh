@@ -0,0 +1,42 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests that GitBSLR adds its events to Git's trace2 event stream, in a way trace2 tools can read.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+echo test >                     test/repo/dir/file
+ln_sr test/repo/dir/file        test/repo/to_file
+mkdir                           test/outside/
+echo test >                     test/outside/file
+ln_sr test/outside/             test/repo/to_outside
+
+cd test/repo/
+git init
+gitbslr add .
+gitbslr commit -m "GitBSLR test"
+rm to_file
+GIT_TRACE2_EVENT=$(pwd)/../trace.log gitbslr checkout to_file
+[ -L to_file ] || exit 1
+#a directory gets one file per process; GitBSLR's is opened before Git has a session ID, so it's named after the pid
+mkdir ../trace.d/
+rm to_file
+GIT_TRACE2_EVENT=$(pwd)/../trace.d gitbslr checkout to_file
+[ $(ls ../trace.d/ | grep -c 'gitbslr-P') = 1 ] || exit 1
+grep -q '"category":"gitbslr"' ../trace.d/*gitbslr-P* || exit 1
+cd ../../
+
+#every line must be valid JSON, and GitBSLR's events must be in Git's session
+perl -MJSON::PP -ne'my $ev = decode_json($_);
+                    $sid = $ev->{sid} if $ev->{event} eq "version";
+                    next unless ($ev->{category} // "") eq "gitbslr";
+                    die "wrong sid $ev->{sid}, expected $sid\n" if $ev->{sid} ne $sid;
+                    $found{$ev->{event} . " " . ($ev->{label} // $ev->{key})} = 1;
+                    END { for ("region_enter symlink", "region_leave symlink", "data_json summary")
+                          { die "missing $_\n" unless $found{$_}; } }' test/trace.log
+
+echo Test passed
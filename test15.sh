@@ -0,0 +1,49 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests GITBSLR_ATTR_TTL, which caches stat results for files under links to outside the work tree.
+
+#the reference implementation's calls would be counted too, and GITBSLR_DEBUG is too noisy
+export GITBSLR_VERIFY=0
+unset GITBSLR_DEBUG GITBSLR_ATTR_TTL
+
+mkdir                             test/repo/
+mkdir                             test/outside/
+for f in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+  echo $f >                       test/repo/file$f
+  echo $f >                       test/outside/file$f
+done
+ln_sr test/outside/               test/repo/to_outside
+
+#usage: stat_calls <git args...>
+#runs a Git command, and prints how many times GitBSLR called stat
+stat_calls()
+{
+  with_stats gitbslr "$@" > /dev/null
+  stats_sum stat
+}
+
+cd test/repo/
+git init
+gitbslr add .
+gitbslr commit -m "GitBSLR test"
+
+#git add looks at every file more than once, so the cache should save at least one stat per outside file
+STRICT=$(stat_calls add .)
+RELAXED=$(GITBSLR_ATTR_TTL=60000 stat_calls add .)
+echo "git add: $STRICT stat calls, $RELAXED with GITBSLR_ATTR_TTL"
+[ $RELAXED -le $((STRICT-20)) ] || exit 1
+
+#and the answers must be the same; files in the work tree itself aren't cached
+echo changed > file1
+echo changed > ../outside/file1
+GITBSLR_ATTR_TTL=60000 gitbslr add .
+[ "$(gitbslr diff --cached --name-only | tr '\n' ' ')" = "file1 to_outside/file1 " ] || exit 1
+[ -z "$(GITBSLR_ATTR_TTL=60000 gitbslr diff --name-only)" ] || exit 1
+cd ../../
+
+echo Test passed
@@ -0,0 +1,43 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests GITBSLR_PROFILE, in a repo big enough that Git checks the files from several threads.
+
+#the reference implementation would be profiled too, and GITBSLR_DEBUG is too noisy for a repo of this size
+export GITBSLR_VERIFY=0
+unset GITBSLR_DEBUG
+
+mkdir                             test/repo/
+mkdir                             test/outside/
+for d in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30; do
+  mkdir                           test/repo/dir$d/
+  for f in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 33 34 35 36 37 38 39 40; do
+    echo $f >                     test/repo/dir$d/file$f
+  done
+done
+echo test >                       test/outside/file
+ln_sr test/outside/               test/repo/to_outside
+
+cd test/repo/
+git init
+gitbslr add .
+gitbslr commit -m "GitBSLR test"
+touch dir*/*
+GITBSLR_PROFILE=$(pwd)/../profile.log with_stats gitbslr -c core.preloadindex=true status
+cd ../../
+cat test/profile.log
+
+#the profile must not count any call twice, or count other threads' calls
+PROFILED=$(sed -n 's/^GitBSLR profile: .*, \([0-9]*\) filesystem calls$/\1/p' test/profile.log)
+TOTAL=$(fs_calls)
+echo "$PROFILED filesystem calls profiled, $TOTAL made"
+[ $PROFILED -gt 0 ] || exit 1
+[ $PROFILED -le $TOTAL ] || exit 1
+grep -q ' \./$' test/profile.log
+grep -q ' to_outside$' test/profile.log
+
+echo Test passed
@@ -0,0 +1,95 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests libgitbslr.a, from a C program, including that errors are returned rather than exiting.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+echo test >                     test/repo/dir/file
+ln_sr test/repo/dir/            test/repo/to_dir
+mkdir                           test/outside/
+echo test >                     test/outside/file
+ln_sr test/outside/             test/repo/to_outside
+git init test/repo/
+mkdir -p                        test/parent/repo/dir/ test/gd/.git/
+echo test >                     test/parent/repo/dir/file
+
+cat > test/libtest.c <<'EOT'
+#include "libgitbslr.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CHECK(x) do { if (!(x)) { printf("failed: %s\n", #x); exit(1); } } while(0)
+
+int main(int argc, char** argv)
+{
+	const char * work_tree = argv[1];
+	struct stat st;
+	char buf[64];
+	ssize_t len;
+	
+	CHECK(gitbslr_open("relative", NULL, NULL) == NULL);
+	CHECK(gitbslr_open(work_tree, NULL, "to_dir:dir*") == NULL);
+	CHECK(gitbslr_open(work_tree, NULL, "to_dir::dir") == NULL);
+	
+	gitbslr_context* ctx = gitbslr_open(work_tree, NULL, NULL);
+	CHECK(ctx);
+	CHECK(gitbslr_lstat(ctx, "to_dir", &st) == 0 && S_ISLNK(st.st_mode));
+	len = gitbslr_readlink(ctx, "to_dir", buf, sizeof(buf));
+	CHECK(len == 3 && !memcmp(buf, "dir", 3));
+	CHECK(gitbslr_lstat(ctx, "to_outside", &st) == 0 && S_ISDIR(st.st_mode));
+	CHECK(gitbslr_lstat(ctx, "to_outside/file", &st) == 0 && S_ISREG(st.st_mode));
+	CHECK(gitbslr_readlink(ctx, "to_outside", buf, sizeof(buf)) == -1 && errno == EINVAL);
+	CHECK(gitbslr_lstat(ctx, "/etc/passwd", &st) == -1 && errno == EINVAL);
+	CHECK(gitbslr_readlink(ctx, "/etc/passwd", buf, sizeof(buf)) == -1 && errno == EINVAL);
+	
+	/* it remembers what to_dir was until flushed */
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/to_dir", work_tree);
+	CHECK(unlink(path) == 0 && mkdir(path, 0777) == 0);
+	gitbslr_flush(ctx);
+	CHECK(gitbslr_lstat(ctx, "to_dir", &st) == 0 && S_ISDIR(st.st_mode));
+	
+	/* the work tree disappearing is an error, not a reason to exit */
+	char moved[4096];
+	snprintf(moved, sizeof(moved), "%s.moved", work_tree);
+	CHECK(rename(work_tree, moved) == 0);
+	CHECK(mkdir(work_tree, 0777) == 0 && mkdir(path, 0777) == 0);
+	gitbslr_flush(ctx);
+	CHECK(rmdir(path) == 0 && rmdir(work_tree) == 0);
+	CHECK(gitbslr_lstat(ctx, "to_dir", &st) == -1);
+	CHECK(rename(moved, work_tree) == 0);
+	
+	gitbslr_close(ctx);
+	
+	/* parents of the work tree are outside it, but Git looks at them; with the Git directory elsewhere, */
+	/* nothing else covers them */
+	char parent[4096];
+	CHECK(realpath(argv[2], parent));
+	*strrchr(parent, '/') = '\0';
+	ctx = gitbslr_open(argv[2], argv[3], NULL);
+	CHECK(ctx);
+	CHECK(gitbslr_lstat(ctx, parent, &st) == 0 && S_ISDIR(st.st_mode));
+	CHECK(gitbslr_lstat(ctx, "..", &st) == 0 && S_ISDIR(st.st_mode));
+	CHECK(gitbslr_readlink(ctx, parent, buf, sizeof(buf)) == -1 && errno == EINVAL);
+	CHECK(gitbslr_lstat(ctx, "dir/file", &st) == 0 && S_ISREG(st.st_mode));
+	gitbslr_close(ctx);
+	
+	printf("libgitbslr works\n");
+	return 0;
+}
+EOT
+cc test/libtest.c -I. libgitbslr.a -ldl -lpthread -lstdc++ -o test/libtest
+test/libtest $(pwd)/test/repo $(pwd)/test/parent/repo $(pwd)/test/gd/.git | grep 'libgitbslr works'
+
+#nothing in libgitbslr.a may clash with the program's own C++ names
+nm -C libgitbslr.a | grep -v ' U ' | grep ' string::' && exit 1
+
+echo Test passed
@@ -0,0 +1,86 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests that GitBSLR doesn't make too many filesystem calls. It's a performance test, but it counts
+# calls rather than measuring time, so it's deterministic; if it fails, something got slower, even if it's not noticeable here.
+
+#the reference implementation would be counted too
+export GITBSLR_VERIFY=0
+#and GITBSLR_DEBUG is too noisy for a repo of this size
+unset GITBSLR_DEBUG
+
+N=0
+mkdir                             test/repo/
+mkdir                             test/outside/
+for d in 1 2 3 4; do
+  mkdir                           test/repo/dir$d/
+  for f in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25; do
+    echo $f >                     test/repo/dir$d/file$f
+    N=$((N+1))
+  done
+done
+for f in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+  echo $f >                       test/outside/file$f
+  N=$((N+1))
+done
+ln_sr test/outside/               test/repo/to_outside
+ln_sr test/repo/dir1/             test/repo/dir2/to_dir1
+
+#usage: calls <git args...>
+#runs a Git command, and sets TOTAL to GitBSLR's calls to readlink/lstat/stat/realpath/getcwd, summed over all processes,
+# and INTERPOSED to how many calls Git made to GitBSLR
+calls()
+{
+  with_stats gitbslr "$@" > /dev/null
+  INTERPOSED=$(stats_sum interposed)
+  TOTAL=$(fs_calls)
+}
+
+#usage: budget <max calls per file> <git args...>
+#runs a Git command, and fails if GitBSLR's calls exceed the budget
+budget()
+{
+  PER_FILE=$1
+  shift
+  calls "$@"
+  echo "git $*: $TOTAL calls for $N files, budget $((PER_FILE*N))"
+  if [ $TOTAL -gt $((PER_FILE*N)) ]; then
+    echo "Error: too many filesystem calls"
+    cat $STATS_LOG
+    exit 1
+  fi
+}
+
+cd test/repo/
+git init
+#about 1.5 times what it takes now; a budget much looser than that wouldn't notice an extra call per file
+budget 8 add .
+git commit -m "GitBSLR test"
+budget 5 status
+budget 5 diff HEAD
+#the second add costs more than the first, so it gets its own budget
+budget 11 add .
+
+#a second alias for the same directory should be nearly free; the directory's contents are only looked at once
+#Git still asks about every file in it, and each of those costs a stat and a getcwd, but anything beyond that is
+# resolution work, which should only be needed for the link itself
+calls status
+WITHOUT=$TOTAL
+WITHOUT_INTERPOSED=$INTERPOSED
+ln_sr ../outside/                 to_outside2
+gitbslr add to_outside2
+git commit -m "GitBSLR test 2"
+calls status
+EXTRA=$((TOTAL-WITHOUT - 2*(INTERPOSED-WITHOUT_INTERPOSED)))
+echo "git status: $((TOTAL-WITHOUT)) more calls with a second alias for 20 files, $EXTRA for resolving them"
+if [ $EXTRA -gt 10 ]; then
+  echo "Error: too many filesystem calls for the alias"
+  exit 1
+fi
+cd ../../
+
+echo Test passed
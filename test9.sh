@@ -0,0 +1,51 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-only
+# GitBSLR is available under the same license as Git itself.
+
+cd $(dirname $0)
+. ./testlib.sh
+
+#This script tests gitbslr-resolve, the standalone tool telling what Git would see.
+
+mkdir                           test/repo/
+mkdir                           test/repo/dir/
+echo test >                     test/repo/dir/file
+ln_sr test/repo/dir/file        test/repo/to_file
+ln_sr test/repo/                test/repo/dir/to_root
+mkdir                           test/outside/
+echo test >                     test/outside/file
+ln_sr test/repo/                test/outside/to_repo
+ln_sr test/outside/             test/repo/to_outside
+ln_sr test/nonexistent          test/repo/broken
+
+printf 'link\tto_file\tdir/file\n'             >> test/expected.log
+printf 'link\tdir/to_root\t..\n'               >> test/expected.log
+printf 'inline\tto_outside\n'                  >> test/expected.log
+printf 'file\tto_outside/file\n'               >> test/expected.log
+printf 'link\tto_outside/to_repo\t..\n'        >> test/expected.log
+printf 'dir\tdir\n'                            >> test/expected.log
+printf 'file\tdir/file\n'                      >> test/expected.log
+printf 'broken\tbroken\n'                      >> test/expected.log
+printf 'missing\tnonexistent\n'                >> test/expected.log
+
+cd test/repo/
+git init
+cut -f2 ../expected.log | ../../gitbslr-resolve -j2 > ../output.log
+cut -f2 ../expected.log | tr '\n' '\0' | ../../gitbslr-resolve -z | tr '\0' '\n' > ../output_z.log
+
+#as a coprocess; each answer must arrive before the next question is asked
+mkfifo ../in ../out
+timeout 10 ../../gitbslr-resolve < ../in > ../out &
+exec 3> ../in 4< ../out
+echo to_file >&3
+[ "$(timeout 5 head -n1 <&4)" = "$(printf 'link\tto_file\tdir/file')" ] || exit 1
+echo dir >&3
+[ "$(timeout 5 head -n1 <&4)" = "$(printf 'dir\tdir')" ] || exit 1
+exec 3>&- 4<&-
+wait
+cd ../../
+
+diff -U999 test/output.log test/expected.log
+diff -U999 test/output_z.log test/expected.log
+
+echo Test passed
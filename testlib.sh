@@ -26,6 +26,7 @@ gitbslr()
   LD_PRELOAD=$GITBSLR $GIT "$@"
 }
 export GITBSLR_DEBUG=1
+export GITBSLR_VERIFY=1
 
 ln_sr()
 {
@@ -46,3 +47,32 @@ tree()
     }, ".");
     ' $1 | grep -v .git | LC_ALL=C sort
 }
+
+#usage: with_stats <command...>
+#runs a command (like gitbslr or gitbslr-resolve) with GITBSLR_STATS writing to a fresh test/stats.log
+STATS_LOG=$(pwd)/test/stats.log
+with_stats()
+{
+  rm -f $STATS_LOG
+  GITBSLR_STATS=$STATS_LOG "$@"
+}
+
+#usage: stats_sum <field...>
+#prints the sum of those fields in test/stats.log, over all processes that wrote to it
+stats_sum()
+{
+  SUM=0
+  for field in "$@"; do
+    for n in $(sed -n "s/.* $field=\([0-9]*\).*/\1/p" $STATS_LOG); do
+      SUM=$((SUM+n))
+    done
+  done
+  echo $SUM
+}
+
+#usage: fs_calls
+#prints how many filesystem calls GitBSLR made, according to test/stats.log
+fs_calls()
+{
+  stats_sum readlink lstat stat realpath getcwd
+}